@@ -26,14 +26,35 @@
 #include <BitBang_I2C.h>
 #include <rtc_eeprom.h>
 
-static int iRTCType;
-static int iRTCAddr;
-static BBI2C bb;
+// default instances used by the legacy functions
+static rtc_dev defRTC;
+static ee_dev defEE;
+#define EE_POLL_TIMEOUT 20 // give up ACK polling after this long (ms)
+
+//
+// Send a message to the EEPROM, retrying while it NAKs
+// During an internal write cycle the EEPROM does not acknowledge
+// its address, so the first successful write marks the end of the cycle
+// returns 1 for success, 0 for timeout
+//
+static int eeWritePolled(ee_dev *pEE, unsigned char *pData, int iLen)
+{
+unsigned long ulStart;
+
+  if (I2CWrite(pEE->pBB, pEE->iAddr, pData, iLen)) // not busy
+     return 1;
+  ulStart = millis();
+  do {
+     if (I2CWrite(pEE->pBB, pEE->iAddr, pData, iLen))
+        return 1;
+  } while (millis() - ulStart < EE_POLL_TIMEOUT);
+  return 0;
+} /* eeWritePolled() */
 
 //
 // Read a byte from the EEPROM
 //
-void eeReadByte(int iAddr, unsigned char *pData)
+void eeDevReadByte(ee_dev *pEE, int iAddr, unsigned char *pData)
 {
 unsigned char ucTemp[4];
 
@@ -41,17 +62,17 @@ unsigned char ucTemp[4];
   {
     ucTemp[0] = (unsigned char)(iAddr >> 8);
     ucTemp[1] = (unsigned char)iAddr;
-    I2CWrite(&bb, EEPROM_ADDR, ucTemp, 2);
-    delay(10);
+    if (!eeWritePolled(pEE, ucTemp, 2)) // waits out a pending write
+       return;
   }
   // otherwise just read from the last address and auto-increment
-  I2CRead(&bb, EEPROM_ADDR, pData, 1);
-} /* eeReadByte() */
+  I2CRead(pEE->pBB, pEE->iAddr, pData, 1);
+} /* eeDevReadByte() */
 //
 // Read a block of 32 bytes from the given address
 // or from the last read address if iAddr == -1
 //
-void eeReadBlock(int iAddr, unsigned char *pData)
+void eeDevReadBlock(ee_dev *pEE, int iAddr, unsigned char *pData)
 {
 unsigned char ucTemp[4];
 
@@ -59,16 +80,17 @@ unsigned char ucTemp[4];
   {
     ucTemp[0] = (unsigned char)(iAddr >> 8);
     ucTemp[1] = (unsigned char)iAddr;
-    I2CWrite(&bb, EEPROM_ADDR, ucTemp, 2);
+    if (!eeWritePolled(pEE, ucTemp, 2))
+       return;
   }
   // otherwise just read from the last address and auto-increment
-  I2CRead(&bb, EEPROM_ADDR, pData, 32);
-} /* eeReadBlock() */
+  I2CRead(pEE->pBB, pEE->iAddr, pData, 32);
+} /* eeDevReadBlock() */
 //
 // Write a byte to the given address
 // or the previous address if iAddr == -1
 //
-void eeWriteByte(int iAddr, unsigned char ucByte)
+void eeDevWriteByte(ee_dev *pEE, int iAddr, unsigned char ucByte)
 {
 unsigned char ucTemp[4];
 
@@ -79,18 +101,18 @@ unsigned char ucTemp[4];
                 ucTemp[2] = ucByte;
                 // The first data byte must be written with
                 // the address atomically or it won't work
-                I2CWrite(&bb, EEPROM_ADDR, ucTemp, 3);
+                eeWritePolled(pEE, ucTemp, 3);
         } // otherwise write from the last address and increment
         else
         {
-                I2CWrite(&bb, EEPROM_ADDR, &ucByte, 1);
+                I2CWrite(pEE->pBB, pEE->iAddr, &ucByte, 1);
         }
-} /* eeWriteByte() */
+} /* eeDevWriteByte() */
 //
 // Write a block of 32 bytes to the given address
 // or from the last read/write address is iAddr == -1
 //
-void eeWriteBlock(int iAddr, unsigned char *pData)
+void eeDevWriteBlock(ee_dev *pEE, int iAddr, unsigned char *pData)
 {
 unsigned char ucTemp[34];
 
@@ -99,72 +121,75 @@ unsigned char ucTemp[34];
                 ucTemp[0] = (unsigned char)(iAddr >> 8);
                 ucTemp[1] = (unsigned char)iAddr;
                 memcpy(&ucTemp[2], pData, 32);
-                I2CWrite(&bb, EEPROM_ADDR, ucTemp, 34);
+                eeWritePolled(pEE, ucTemp, 34);
         } // otherwise write to the last address and increment
         else
         {
-                I2CWrite(&bb, EEPROM_ADDR, pData, 32);
+                I2CWrite(pEE->pBB, pEE->iAddr, pData, 32);
         }
-} /* eeWriteBlock() */
+} /* eeDevWriteBlock() */
 //
 // Turn on the RTC
 // returns 1 for success, 0 for failure
 //
-int rtcInit(int iType, int iSDA, int iSCL, int bWire)
+int rtcDevInit(rtc_dev *pRTC, int iType, int iSDA, int iSCL, int bWire)
 {
 uint8_t ucTemp[4];
 
   if (iType <= RTC_UNKNOWN || iType >= RTC_TYPE_COUNT) // invalid type
      return 0;
-  iRTCType = iType;
-  if (iRTCType == RTC_DS3231)
-     iRTCAddr = RTC_DS3231_ADDR;
-  else if (iRTCType == RTC_RV3032)
-     iRTCAddr = RTC_RV3032_ADDR;
+  pRTC->iType = iType;
+  if (pRTC->iType == RTC_DS3231)
+     pRTC->iAddr = RTC_DS3231_ADDR;
+  else if (pRTC->iType == RTC_RV3032)
+     pRTC->iAddr = RTC_RV3032_ADDR;
   else
-     iRTCAddr = RTC_PCF8563_ADDR;
+     pRTC->iAddr = RTC_PCF8563_ADDR;
 
-  memset(&bb,0,sizeof(bb));
-  bb.iSDA = iSDA;
-  bb.iSCL = iSCL;
-  bb.bWire = bWire;
-  I2CInit(&bb, 100000L); // initialize the bit bang library
+  memset(&pRTC->bb,0,sizeof(pRTC->bb));
+  pRTC->bb.iSDA = iSDA;
+  pRTC->bb.iSCL = iSCL;
+  pRTC->bb.bWire = bWire;
+  I2CInit(&pRTC->bb, 100000L); // initialize the bit bang library
   if (iType == RTC_DS3231) {
     ucTemp[0] = 0xe; // control register
     ucTemp[1] = 0x1c; // enable main oscillator and interrupt mode for alarms
-    I2CWrite(&bb, iRTCAddr, ucTemp, 2);
+    I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 2);
+    pRTC->ucControl = ucTemp[1]; // later changes start from what we wrote
   } else if (iType == RTC_RV3032) {
     // Enable direct switchover mode to the backup battery (disabled on delivery)
     ucTemp[0] = 0xc0; // EEPROM PMU
     ucTemp[1] = 0x10; // enable direct VBACKUP switchover, disable trickle charge
-    I2CWrite(&bb, iRTCAddr, ucTemp, 2); 
+    I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 2);
+    pRTC->ucPMU = ucTemp[1];
   } else { // PCF8563
     ucTemp[0] = 0; // control_status_1
     ucTemp[1] = 0; // normal mode, clock on, power-on-reset disabled
     ucTemp[2] = 0; // disable all alarms
-    I2CWrite(&bb, iRTCAddr, ucTemp, 3);
+    I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 3);
   }
   return 1;
-} /* rtcInit() */
+} /* rtcDevInit() */
 //
 // Enable/set the CLKOUT frequency (-1 = disable)
 //
-void rtcSetFreq(int iFreq)
+void rtcDevSetFreq(rtc_dev *pRTC, int iFreq)
 {
 uint8_t c, ucTemp[4];
 int i;
 
-   if (iRTCType == RTC_RV3032) {
+   if (pRTC->iType == RTC_RV3032) {
+      // the PMU register comes from the shadow copy instead of a read
       if (iFreq == -1) { // disable it
-          I2CRead(&bb, 0xc0, &ucTemp[1], 1); // read control register
-          ucTemp[0] = 0xc0; // write it back with NCLKE set to disable CLKOUT
-          ucTemp[1] |= 0x40; // set NCLKE
-          I2CWrite(&bb, iRTCAddr, ucTemp, 2);
+          pRTC->ucPMU |= 0x40; // set NCLKE to disable CLKOUT
+          ucTemp[0] = 0xc0;
+          ucTemp[1] = pRTC->ucPMU;
+          I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 2);
       } else { // enable clock
-          I2CRead(&bb, 0xc0, &ucTemp[1], 1); // read control register
-          ucTemp[0] = 0xc0; // write it back with NCLKE set to disable CLKOUT
-          ucTemp[1] &= ~0x40; // clear NCLKE
-          I2CWrite(&bb, iRTCAddr, ucTemp, 2);
+          pRTC->ucPMU &= ~0x40; // clear NCLKE
+          ucTemp[0] = 0xc0;
+          ucTemp[1] = pRTC->ucPMU;
+          I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 2);
           c = 0; // default = 32768
           if (iFreq <= 32768) { // low speed
              ucTemp[0] = 0xc3; // CLKOUT control
@@ -172,7 +197,7 @@ int i;
              else if (iFreq == 64) c = 2;
              else if (iFreq == 1) c = 3; // all other values will stay at 32k
              ucTemp[1] = c << 5; // bits 5+6 in 32k mode
-             I2CWrite(&bb, iRTCAddr, ucTemp, 2);
+             I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 2);
           } else { // high speed
              ucTemp[0] = 0xc2; // HFD + CLKOUT control
              i = (iFreq / 8192000) - 1;
@@ -180,52 +205,54 @@ int i;
              else if (i > 8191) i = 8191; // top 13 bits of freq up to 67Mhz
              ucTemp[1] = (uint8_t)(i & 0xff);
              ucTemp[2] = (uint8_t)(0x80 | ((i >> 8) & 0x1f));
-             I2CWrite(&bb, iRTCAddr, ucTemp, 3);
+             I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 3);
           }
       }
-   } else if (iRTCType == RTC_DS3231) {
+   } else if (pRTC->iType == RTC_DS3231) {
        if (iFreq == -1) { // disable CLKOUT (allow interrupts)
-          ucTemp[0] = 0xe;// control register
-          ucTemp[1] = 0x4; // disable SQW and enable interrupts 
+          pRTC->ucControl &= ~0x40; // disable SQW
+          pRTC->ucControl |= 0x4; // enable interrupts
        } else { // enable CLKOUT (disable interrupts)
-          ucTemp[0] = 0xe;
           c = 3; // assume 8192Hz (default
           if (iFreq == 1) c = 0;
           else if (iFreq == 1024) c = 1;
           else if (iFreq == 4096) c = 2;
           else if (iFreq == 8192) c = 3;
-          ucTemp[1] = 0x40 | (c << 3); // enable SQW, disable interrupts
+          pRTC->ucControl &= ~0x1c; // rate + INTCN
+          pRTC->ucControl |= 0x40 | (c << 3); // enable SQW, disable interrupts
        }
-       I2CWrite(&bb, iRTCAddr, ucTemp, 2);
-   } else if (iRTCType == RTC_PCF8563) {
+       ucTemp[0] = 0xe; // control register
+       ucTemp[1] = pRTC->ucControl; // the alarm enables stay as they were
+       I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 2);
+   } else if (pRTC->iType == RTC_PCF8563) {
    }
-} /* rtcSetFreq() */
+} /* rtcDevSetFreq() */
 //
 // Get the UNIX epoch time
 // (only available on the RV-3032-C7
 //
-uint32_t rtcGetEpoch(void)
+uint32_t rtcDevGetEpoch(rtc_dev *pRTC)
 {
 uint32_t tt = 0;
 
-   if (iRTCType != RTC_RV3032)
+   if (pRTC->iType != RTC_RV3032)
       return tt;
-   I2CRead(&bb, 0x1b, (uint8_t *)&tt, sizeof(tt)); 
+   I2CRead(&pRTC->bb, 0x1b, (uint8_t *)&tt, sizeof(tt)); 
    return tt;
-} /* rtcGetEpoch() */
+} /* rtcDevGetEpoch() */
 //
 // Set the UNIX epoch time
 // (only available on the RV-3032-C7
 //
-void rtcSetEpoch(uint32_t tt)
+void rtcDevSetEpoch(rtc_dev *pRTC, uint32_t tt)
 {
 uint8_t ucTemp[4];
 
-  I2CRead(&bb, 0x10, ucTemp, 1); // read control register 2
+  I2CRead(&pRTC->bb, 0x10, ucTemp, 1); // read control register 2
   ucTemp[0] |= 1; // set RESET BIT
-  I2CWrite(&bb, 0x10, ucTemp, 1); // do a reset of seconds and prescaler
-  I2CWrite(&bb, 0x1b, (uint8_t *)&tt, sizeof(tt)); // set time
-} /* rtcSetEpoch() */
+  I2CWrite(&pRTC->bb, 0x10, ucTemp, 1); // do a reset of seconds and prescaler
+  I2CWrite(&pRTC->bb, 0x1b, (uint8_t *)&tt, sizeof(tt)); // set time
+} /* rtcDevSetEpoch() */
 
 //
 // Set Alarm for:
@@ -235,34 +262,36 @@ uint8_t ucTemp[4];
 // ALARM_DAY = When a specific day of the week and time match
 // ALARM_DATE = When a specific day of the month and time match
 //
-void rtcSetAlarm(uint8_t type, struct tm *pTime)
+void rtcDevSetAlarm(rtc_dev *pRTC, uint8_t type, struct tm *pTime)
 {
 uint8_t ucTemp[8];
 
-  if (iRTCType == RTC_DS3231)
+  if (pRTC->iType == RTC_DS3231)
   {
     switch (type)
     {
       case ALARM_SECOND: // turn on repeating alarm for every second
+        pRTC->ucControl = (pRTC->ucControl & ~3) | 0x5; // enable alarm1 interrupt
         ucTemp[0] = 0xe; // control register
-        ucTemp[1] = 0x1d; // enable alarm1 interrupt
-        I2CWrite(&bb, iRTCAddr, ucTemp, 2);
+        ucTemp[1] = pRTC->ucControl;
+        I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 2);
         ucTemp[0] = 0x7; // starting register for alarm 1
         ucTemp[1] = 0x80; // set bit 7 in the 4 registers to tell it a repeating alarm
         ucTemp[2] = 0x80;
         ucTemp[3] = 0x80;
         ucTemp[4] = 0x80;
-        I2CWrite(&bb, iRTCAddr, ucTemp, 5);
+        I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 5);
         break;
       case ALARM_MINUTE: // turn on repeating alarm for every minute
+        pRTC->ucControl = (pRTC->ucControl & ~3) | 0x6; // enable alarm2 interrupt
         ucTemp[0] = 0xe; // control register
-        ucTemp[1] = 0x1e; // enable alarm2 interrupt
-        I2CWrite(&bb, iRTCAddr, ucTemp, 2);
+        ucTemp[1] = pRTC->ucControl;
+        I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 2);
         ucTemp[0] = 0xb; // starting register for alarm 2
         ucTemp[1] = 0x80; // set bit 7 in the 3 registers to tell it a repeating alarm
         ucTemp[2] = 0x80;
         ucTemp[3] = 0x80;
-        I2CWrite(&bb, iRTCAddr, ucTemp, 4);
+        I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 4);
         break;
       case ALARM_TIME: // turn on alarm to match a specific time
       case ALARM_DAY: // turn on alarm for a specific day of the week
@@ -304,42 +333,43 @@ uint8_t ucTemp[8];
           ucTemp[4] |= 0x40; // DY/DT bit
         }
         // for matching the date, all bits are left as 0's (00000)
-        I2CWrite(&bb, iRTCAddr, ucTemp, 5);
+        I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 5);
+        pRTC->ucControl = (pRTC->ucControl & ~3) | 0x5; // enable alarm1 interrupt
         ucTemp[0] = 0xe; // control register
-        ucTemp[1] = 0x5; // enable alarm1 interrupt
+        ucTemp[1] = pRTC->ucControl;
         ucTemp[2] = 0x00; // reset alarm status bits
-        I2CWrite(&bb, iRTCAddr, ucTemp, 3);
+        I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 3);
         break;
      } // switch on type
   }
-  else if (iRTCType == RTC_PCF8563)
+  else if (pRTC->iType == RTC_PCF8563)
   {
     switch (type)
     {
       case ALARM_SECOND: // turn on repeating alarm for every second
         ucTemp[0] = 0x1; // control_status_2
         ucTemp[1] = 0x5; // enable timer & interrupt
-        I2CWrite(&bb, iRTCAddr, ucTemp, 2);
+        I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 2);
         ucTemp[0] = 0xe; // timer control
         ucTemp[1] = 0x81; // enable timer for 1/64 second interval
         ucTemp[2] = 0x40; // timer count value (64 = 1 second)
-        I2CWrite(&bb, iRTCAddr, ucTemp, 3);
+        I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 3);
         break;
       case ALARM_MINUTE: // turn on repeating timer for every minute
         ucTemp[0] = 0x1; // control_status_2
         ucTemp[1] = 0x5; // enable timer & interrupt
-        I2CWrite(&bb, iRTCAddr, ucTemp, 2);
+        I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 2);
         ucTemp[0] = 0xe; // timer control
         ucTemp[1] = 0x82; // enable timer for 1 hz interval
         ucTemp[2] = 0x3c; // 60 = 1 minute
-        I2CWrite(&bb, iRTCAddr, ucTemp, 3);
+        I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 3);
         break;
       case ALARM_TIME: // turn on alarm to match a specific time
       case ALARM_DAY: // turn on alarm for a specific day of the week
       case ALARM_DATE: // turn on alarm for a specific date
         ucTemp[0] = 0x1; // control_status_2
         ucTemp[1] = 0xa; // enable alarm & interrupt
-        I2CWrite(&bb, iRTCAddr, ucTemp, 2);
+        I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 2);
 // Values are stored as BCD
         ucTemp[0] = 0x9; // start at register 9
         // seconds
@@ -377,41 +407,41 @@ uint8_t ucTemp[8];
         {
           ucTemp[4] &= 0x7f;
         }
-        I2CWrite(&bb, iRTCAddr, ucTemp, 6);
+        I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 6);
         break;
      } // switch on alarm type
    } // PCF8563
-} /* rtcSetAlarm() */
+} /* rtcDevSetAlarm() */
 //
 // Read the current internal temperature
 // Value is celcius * 4 (resolution of 0.25C)
 //
-int rtcGetTemp(void)
+int rtcDevGetTemp(rtc_dev *pRTC)
 {
 unsigned char ucTemp[2];
 int iTemp = 0;
 
-  if (iRTCType == RTC_DS3231) {
-    I2CReadRegister(&bb, iRTCAddr, 0x11, ucTemp, 2); // MSB location
+  if (pRTC->iType == RTC_DS3231) {
+    I2CReadRegister(&pRTC->bb, pRTC->iAddr, 0x11, ucTemp, 2); // MSB location
     iTemp = ucTemp[0] << 8; // high byte
     iTemp |= ucTemp[1]; // low byte
     iTemp >>= 6; // lower 2 bits are fraction; upper 8 bits = integer part
-  } else if (iRTCType == RTC_RV3032) {
-    I2CReadRegister(&bb, iRTCAddr, 0x0e, ucTemp, 2); // LSB, then MSB
+  } else if (pRTC->iType == RTC_RV3032) {
+    I2CReadRegister(&pRTC->bb, pRTC->iAddr, 0x0e, ucTemp, 2); // LSB, then MSB
     iTemp = ucTemp[0] | (ucTemp[1] << 8);
     iTemp >>= 6; // lower 2 bits are fraction upper 8 are integer
   }
   return iTemp; // no temperature sensor
-} /* rtcGetTemp() */
+} /* rtcDevGetTemp() */
 //
 // Set the current time/date
 //
-void rtcSetTime(struct tm *pTime)
+void rtcDevSetTime(rtc_dev *pRTC, struct tm *pTime)
 {
 unsigned char ucTemp[20];
 uint8_t i;
 
-   if (iRTCType == RTC_DS3231) {
+   if (pRTC->iType == RTC_DS3231) {
 // Values are stored as BCD
         ucTemp[0] = 0; // start at register 0
         // seconds
@@ -437,7 +467,7 @@ uint8_t i;
         // year
         ucTemp[7] = (((pTime->tm_year % 100)/10) << 4);
         ucTemp[7] |= (pTime->tm_year % 10);
-    } else if (iRTCType == RTC_PCF8563) {
+    } else if (pRTC->iType == RTC_PCF8563) {
         ucTemp[0] = 2; // start at register 2
         // seconds
         ucTemp[1] = ((pTime->tm_sec / 10) << 4);
@@ -462,7 +492,7 @@ uint8_t i;
         // year
         ucTemp[7] = (((pTime->tm_year % 100)/10) << 4);
         ucTemp[7] |= (pTime->tm_year % 10);
-    } else if (iRTCType == RTC_RV3032) {
+    } else if (pRTC->iType == RTC_RV3032) {
 // Values are stored as BCD
         ucTemp[0] = 1; // start at register 1
         // seconds
@@ -487,19 +517,19 @@ uint8_t i;
         ucTemp[7] = (((pTime->tm_year % 100)/10) << 4);
         ucTemp[7] |= (pTime->tm_year % 10);
     }
-    I2CWrite(&bb, iRTCAddr, ucTemp, 8);
+    I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 8);
 
-} /* rtcSetTime() */
+} /* rtcDevSetTime() */
 
 //
 // Read the current time/date
 //
-void rtcGetTime(struct tm *pTime)
+void rtcDevGetTime(rtc_dev *pRTC, struct tm *pTime)
 {
 unsigned char ucTemp[20];
 
-  if (iRTCType == RTC_DS3231) {
-        I2CReadRegister(&bb, iRTCAddr, 0, ucTemp, 7); // start of data registers
+  if (pRTC->iType == RTC_DS3231) {
+        I2CReadRegister(&pRTC->bb, pRTC->iAddr, 0, ucTemp, 7); // start of data registers
         memset(pTime, 0, sizeof(struct tm));
         // convert numbers from BCD
         pTime->tm_sec = ((ucTemp[0] >> 4) * 10) + (ucTemp[0] & 0xf);
@@ -522,8 +552,8 @@ unsigned char ucTemp[20];
         pTime->tm_mon = (((ucTemp[5] >> 4) & 1) * 10 + (ucTemp[5] & 0xf)) -1; // 0-11
         pTime->tm_year = (ucTemp[5] >> 7) * 100; // century
         pTime->tm_year += ((ucTemp[6] >> 4) * 10) + (ucTemp[6] & 0xf);
-  } else if (iRTCType == RTC_PCF8563) {
-        I2CReadRegister(&bb, iRTCAddr, 2, ucTemp, 7); // start of data registers
+  } else if (pRTC->iType == RTC_PCF8563) {
+        I2CReadRegister(&pRTC->bb, pRTC->iAddr, 2, ucTemp, 7); // start of data registers
         memset(pTime, 0, sizeof(struct tm));
         // convert numbers from BCD
         pTime->tm_sec = (((ucTemp[0] >> 4) & 7) * 10) + (ucTemp[0] & 0xf);
@@ -537,8 +567,8 @@ unsigned char ucTemp[20];
         pTime->tm_mon = (((ucTemp[5] >> 4) & 1) * 10 + (ucTemp[5] & 0xf)) -1; // 0-11
         pTime->tm_year = (ucTemp[5] >> 7) * 100; // century
         pTime->tm_year += ((ucTemp[6] >> 4) * 10) + (ucTemp[6] & 0xf);
-  } else if (iRTCType == RTC_RV3032) {
-        I2CReadRegister(&bb, iRTCAddr, 0x01, ucTemp, 7); // start of data registers
+  } else if (pRTC->iType == RTC_RV3032) {
+        I2CReadRegister(&pRTC->bb, pRTC->iAddr, 0x01, ucTemp, 7); // start of data registers
         memset(pTime, 0, sizeof(struct tm));
         // convert numbers from BCD
         pTime->tm_sec = ((ucTemp[0] >> 4) * 10) + (ucTemp[0] & 0xf);
@@ -551,27 +581,96 @@ unsigned char ucTemp[20];
         pTime->tm_mon = (((ucTemp[5] >> 4) & 1) * 10 + (ucTemp[5] & 0xf)) -1; // 0-11     
         pTime->tm_year = 100 + ((ucTemp[6] >> 4) * 10) + (ucTemp[6] & 0xf);
   }
-} /* rtcGetTime() */
+} /* rtcDevGetTime() */
 //
 // Reset the "fired" bits for Alarm 1 and 2
 // Interrupts will not occur until these bits are cleared
 //
-void rtcClearAlarms(void)
+void rtcDevClearAlarms(rtc_dev *pRTC)
 {
 uint8_t ucTemp[4];
 
-  if (iRTCType == RTC_DS3231)
+  if (pRTC->iType == RTC_DS3231)
   {
+    pRTC->ucControl = (pRTC->ucControl & ~3) | 0x4; // disable alarm interrupt bits
     ucTemp[0] = 0xe; // control register
-    ucTemp[1] = 0x4; // disable alarm interrupt bits
+    ucTemp[1] = pRTC->ucControl;
     ucTemp[2] = 0x0; // clear A1F & A2F (alarm 1 or 2 fired) bit to allow it to fire again
-    I2CWrite(&bb, iRTCAddr, ucTemp, 3);
+    I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 3);
   }
-  else if (iRTCType == RTC_PCF8563)
+  else if (pRTC->iType == RTC_PCF8563)
   {
     ucTemp[0] = 1; // control_status_2
     ucTemp[1] = 0; // disable all alarms
-    I2CWrite(&bb, iRTCAddr, ucTemp, 2);
+    I2CWrite(&pRTC->bb, pRTC->iAddr, ucTemp, 2);
   }
-} /* rtcClearAlarms() */
+} /* rtcDevClearAlarms() */
+
+//
+// Attach an EEPROM which shares the I2C bus of an RTC
+//
+void eeDevInit(ee_dev *pEE, rtc_dev *pRTC, int iAddr)
+{
+  pEE->pBB = &pRTC->bb;
+  pEE->iAddr = iAddr;
+} /* eeDevInit() */
+//
+// Legacy API
+// These operate on a single default RTC and EEPROM
+//
+int rtcInit(int iType, int iSDA, int iSCL, int bWire)
+{
+int rc;
 
+  rc = rtcDevInit(&defRTC, iType, iSDA, iSCL, bWire);
+  eeDevInit(&defEE, &defRTC, EEPROM_ADDR);
+  return rc;
+} /* rtcInit() */
+void rtcSetFreq(int iFreq)
+{
+  rtcDevSetFreq(&defRTC, iFreq);
+} /* rtcSetFreq() */
+uint32_t rtcGetEpoch(void)
+{
+  return rtcDevGetEpoch(&defRTC);
+} /* rtcGetEpoch() */
+void rtcSetEpoch(uint32_t tt)
+{
+  rtcDevSetEpoch(&defRTC, tt);
+} /* rtcSetEpoch() */
+void rtcSetAlarm(uint8_t type, struct tm *pTime)
+{
+  rtcDevSetAlarm(&defRTC, type, pTime);
+} /* rtcSetAlarm() */
+int rtcGetTemp(void)
+{
+  return rtcDevGetTemp(&defRTC);
+} /* rtcGetTemp() */
+void rtcSetTime(struct tm *pTime)
+{
+  rtcDevSetTime(&defRTC, pTime);
+} /* rtcSetTime() */
+void rtcGetTime(struct tm *pTime)
+{
+  rtcDevGetTime(&defRTC, pTime);
+} /* rtcGetTime() */
+void rtcClearAlarms(void)
+{
+  rtcDevClearAlarms(&defRTC);
+} /* rtcClearAlarms() */
+void eeReadByte(int iAddr, unsigned char *pData)
+{
+  eeDevReadByte(&defEE, iAddr, pData);
+} /* eeReadByte() */
+void eeReadBlock(int iAddr, unsigned char *pData)
+{
+  eeDevReadBlock(&defEE, iAddr, pData);
+} /* eeReadBlock() */
+void eeWriteByte(int iAddr, unsigned char ucByte)
+{
+  eeDevWriteByte(&defEE, iAddr, ucByte);
+} /* eeWriteByte() */
+void eeWriteBlock(int iAddr, unsigned char *pData)
+{
+  eeDevWriteBlock(&defEE, iAddr, pData);
+} /* eeWriteBlock() */
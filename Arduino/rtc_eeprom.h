@@ -1,6 +1,8 @@
 #ifndef __RTC_EEPROM__
 #define __RTC_EEPROM__
 
+#include <BitBang_I2C.h>
+
 // I2C base address of the DS3231 RTC and AT24C32 EEPROM
 #define RTC_DS3231_ADDR 0x68
 #define EEPROM_ADDR 0x57
@@ -44,6 +46,45 @@ enum {
   ALARM_DATE
 };
 //
+// Device contexts
+// Each RTC owns its I2C bus; EEPROMs share the bus of an RTC
+// so several EEPROMs (0x50-0x57) can be used at the same time
+//
+typedef struct rtc_dev
+{
+  int iType;
+  int iAddr;
+  BBI2C bb;
+  uint8_t ucControl; // shadow of the DS3231 control register (0x0E)
+  uint8_t ucPMU; // shadow of the RV-3032 PMU register (0xC0)
+} rtc_dev;
+
+typedef struct ee_dev
+{
+  BBI2C *pBB;
+  int iAddr;
+} ee_dev;
+//
+// Context versions of the functions below
+//
+int rtcDevInit(rtc_dev *pRTC, int iType, int iSDAPin, int iSCLPin, int bWire);
+void rtcDevSetFreq(rtc_dev *pRTC, int iFreq);
+void rtcDevSetAlarm(rtc_dev *pRTC, uint8_t type, struct tm *thetime);
+int rtcDevGetTemp(rtc_dev *pRTC);
+void rtcDevSetTime(rtc_dev *pRTC, struct tm *pTime);
+void rtcDevGetTime(rtc_dev *pRTC, struct tm *pTime);
+void rtcDevClearAlarms(rtc_dev *pRTC);
+uint32_t rtcDevGetEpoch(rtc_dev *pRTC);
+void rtcDevSetEpoch(rtc_dev *pRTC, uint32_t tt);
+void eeDevInit(ee_dev *pEE, rtc_dev *pRTC, int iAddr);
+void eeDevWriteByte(ee_dev *pEE, int iAddr, unsigned char ucByte);
+void eeDevWriteBlock(ee_dev *pEE, int iAddr, unsigned char *pData);
+void eeDevReadByte(ee_dev *pEE, int iAddr, unsigned char *pData);
+void eeDevReadBlock(ee_dev *pEE, int iAddr, unsigned char *pData);
+//
+// The functions below use a single default RTC and the EEPROM at
+// EEPROM_ADDR on its bus
+//
 // Turn on the RTC
 // returns 1 for success, 0 for failure
 //
@@ -0,0 +1,236 @@
+//
+// RTC + EEPROM benchmark
+// Calls each API function in a loop and reports the latency
+// percentiles and the I2C traffic it caused per call
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "rtc.h"
+
+#define SIM_CHANNEL 99 // I2C channel number given to the simulated bus
+#define RTC_ADDR 0x68
+#define EE_ADDR 0x57
+#define EE_SIZE 4096
+
+static int iChannel;
+static rtc_sim *pSim; // NULL when running on real hardware
+static ee_async *pAsync;
+static int64_t *pSamples;
+static unsigned char ucBuf[EE_SIZE];
+
+typedef int (*bench_fn)(int iPass);
+
+void ShowHelp(void)
+{
+	printf("bench - measures the cost of the RTC and EEPROM functions\n");
+	printf("written by Larry Bank\n\n");
+	printf("Usage:\n");
+	printf("bench [sim|<channel>] [iterations]\n");
+	printf("  sim - simulated DS3231 + AT24C32 (default)\n");
+	printf("  <channel> - real devices on /dev/i2c-<channel>\n\n");
+	printf("xfer = I2C transactions per call (each one is an ioctl on real hardware)\n");
+	printf("bus = modelled time on the wires per call (simulator only)\n");
+} /* ShowHelp() */
+
+static int64_t GetNs(void)
+{
+struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+} /* GetNs() */
+
+static int CompareNs(const void *a, const void *b)
+{
+int64_t l1 = *(const int64_t *)a, l2 = *(const int64_t *)b;
+
+	return (l1 > l2) - (l1 < l2);
+} /* CompareNs() */
+
+//
+// The functions being measured
+//
+static int BenchGetTime(int iPass)
+{
+struct tm tm;
+
+	return rtcGetTime(&tm);
+} /* BenchGetTime() */
+
+static int BenchGetEpoch(int iPass)
+{
+	return (rtcGetEpoch() < 0) ? -1 : 0;
+} /* BenchGetEpoch() */
+
+static int BenchGetTemp(int iPass)
+{
+	rtcGetTemp();
+	return 0;
+} /* BenchGetTemp() */
+
+static int BenchSnapshot(int iPass)
+{
+rtc_snapshot snap;
+
+	return rtcSnapshot(&snap);
+} /* BenchSnapshot() */
+
+static int BenchNow(int iPass)
+{
+	return (rtcNow(rtcGetHandle()) < 0) ? -1 : 0;
+} /* BenchNow() */
+
+static int BenchReadByte(int iPass)
+{
+	return (eeReadByte(iPass % EE_SIZE, ucBuf) == 1) ? 0 : -1; // 1 = success
+} /* BenchReadByte() */
+
+static int BenchReadBlock(int iPass)
+{
+	return (eeReadBlock((iPass * 32) % EE_SIZE, ucBuf) == 1) ? 0 : -1;
+} /* BenchReadBlock() */
+
+static int BenchRead4K(int iPass)
+{
+	return (eeRead(0, ucBuf, EE_SIZE) == EE_SIZE) ? 0 : -1;
+} /* BenchRead4K() */
+
+static int BenchWriteByte(int iPass)
+{
+	return (eeWriteByte(iPass % EE_SIZE, (unsigned char)iPass) == 1) ? 0 : -1;
+} /* BenchWriteByte() */
+
+static int BenchWriteBlock(int iPass)
+{
+	memset(ucBuf, iPass, 32);
+	return (eeWriteBlock((iPass * 32) % EE_SIZE, ucBuf) == 1) ? 0 : -1;
+} /* BenchWriteBlock() */
+
+static int BenchAsyncWrite(int iPass)
+{
+	memset(ucBuf, iPass, 8);
+	return eeAsyncWrite(pAsync, (iPass * 8) % EE_SIZE, ucBuf, 8, NULL, NULL);
+} /* BenchAsyncWrite() */
+
+static int BenchAsyncFlush(int iPass)
+{
+	return eeAsyncFlush(pAsync);
+} /* BenchAsyncFlush() */
+
+//
+// Run one function iCount times and print a line of results
+// pfnFinish (or NULL) completes work the calls left queued; its time is
+// printed separately and its bus traffic is included in the row
+//
+static void RunBench(const char *szName, bench_fn pfnBench, bench_fn pfnFinish, int iCount)
+{
+rtc_bus_stats stats;
+int64_t llStart, llFinish = 0, llBus = 0;
+int i, iErrors = 0;
+
+	rtcBusResetStats(iChannel);
+	if (pSim)
+		llBus = rtcSimBusTime(pSim);
+	for (i=0; i<iCount; i++)
+	{
+		llStart = GetNs();
+		if ((*pfnBench)(i) < 0)
+			iErrors++;
+		pSamples[i] = GetNs() - llStart;
+	}
+	if (pfnFinish)
+	{
+		llStart = GetNs();
+		if ((*pfnFinish)(iCount) < 0)
+			iErrors++;
+		llFinish = GetNs() - llStart;
+	}
+	if (pSim)
+		llBus = rtcSimBusTime(pSim) - llBus;
+	memset(&stats, 0, sizeof(stats));
+	rtcBusGetStats(iChannel, &stats);
+	qsort(pSamples, iCount, sizeof(int64_t), CompareNs);
+	printf("%-14s %9.2f %9.2f %6.2f %6.2f %8.1f", szName,
+		pSamples[iCount/2] / 1000.0, pSamples[(iCount*99)/100] / 1000.0,
+		(double)stats.ullTransfers / iCount, (double)stats.ullMessages / iCount,
+		(double)stats.ullBytes / iCount);
+	if (pSim)
+		printf(" %9.2f", (llBus / 1000.0) / iCount);
+	else
+		printf(" %9s", "-");
+	if (pfnFinish)
+		printf("  (finish %.2f us)", llFinish / 1000.0);
+	if (iErrors)
+		printf("  (%d errors)", iErrors);
+	printf("\n");
+} /* RunBench() */
+
+int main(int argc, char *argv[])
+{
+int iCount = 1000;
+
+	if (argc > 3 || (argc > 1 && argv[1][0] == '-'))
+	{
+		ShowHelp();
+		return 0;
+	}
+	if (argc < 2 || strcmp(argv[1], "sim") == 0)
+	{
+		// virtual time, so the EEPROM write cycles don't make the
+		// host clock part of the measurement
+		iChannel = SIM_CHANNEL;
+		pSim = rtcSimCreate(iChannel, 400000, 1);
+		if (pSim == NULL || rtcSimAddRTC(pSim, RTC_DS3231, RTC_ADDR, time(NULL)) != 0 ||
+			rtcSimAddEEPROM(pSim, EE_ADDR, EE_SIZE, 32, 5000) != 0)
+		{
+			printf("Error creating the simulated devices\n");
+			return -1;
+		}
+	}
+	else
+	{
+		iChannel = atoi(argv[1]);
+	}
+	if (argc > 2)
+		iCount = atoi(argv[2]);
+	if (iCount < 1)
+		iCount = 1;
+	pSamples = (int64_t *)malloc(iCount * sizeof(int64_t));
+	if (pSamples == NULL)
+		return -1;
+	if (rtcInit(iChannel, RTC_ADDR) != 0 || eeInit(iChannel, EE_ADDR) != 0)
+	{
+		printf("Error opening the devices\n");
+		return -1;
+	}
+	printf("%s, %d iterations\n\n", (pSim) ? "Simulated devices" : "Hardware", iCount);
+	printf("%-14s %9s %9s %6s %6s %8s %9s\n", "function", "p50 us", "p99 us", "xfer", "msgs", "bytes", "bus us");
+	RunBench("rtcGetTime", BenchGetTime, NULL, iCount);
+	RunBench("rtcGetEpoch", BenchGetEpoch, NULL, iCount);
+	RunBench("rtcGetTemp", BenchGetTemp, NULL, iCount);
+	RunBench("rtcSnapshot", BenchSnapshot, NULL, iCount);
+	RunBench("rtcNow", BenchNow, NULL, iCount);
+	if (rtcClockSync(rtcGetHandle()) == 0)
+		RunBench("rtcNow cached", BenchNow, NULL, iCount);
+	RunBench("eeReadByte", BenchReadByte, NULL, iCount);
+	RunBench("eeReadBlock", BenchReadBlock, NULL, iCount);
+	RunBench("eeRead 4K", BenchRead4K, NULL, iCount);
+	RunBench("eeWriteByte", BenchWriteByte, NULL, iCount);
+	RunBench("eeWriteBlock", BenchWriteBlock, NULL, iCount);
+	pAsync = eeAsyncOpen(eeGetHandle(), iCount); // deep enough to never fill
+	if (pAsync)
+	{
+		RunBench("eeAsync+flush", BenchAsyncWrite, BenchAsyncFlush, iCount);
+		eeAsyncClose(pAsync);
+	}
+	rtcShutdown();
+	rtcSimFree(pSim);
+	free(pSamples);
+
+return 0;
+} /* main() */
@@ -0,0 +1,362 @@
+//
+// DS3231 and xxx
+// Real Time Clock + EEPROM library
+// Asynchronous EEPROM writes
+//
+// eeAsyncWrite() copies the data into a bounded lock-free queue and
+// returns at once; it never takes a lock or waits for the bus, so it
+// can be called from a real-time loop. A worker thread drains the
+// queue in batches, merges the writes which land on the same page into
+// a single page write, waits (ACK polling) for the last write cycle and
+// then calls the completion callbacks. eeAsyncFlush() is a fence which
+// waits for everything queued before it.
+//
+// The queue is the usual bounded MPMC ring: each slot has a sequence
+// number which tells producers and consumers whose turn it is.
+//
+// Written by Larry Bank
+// Copyright (c) 2018 BitBank Software, Inc.
+// bitbank@pobox.com
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "rtc.h"
+#include "rtc_priv.h"
+
+typedef struct ee_async_req {
+	int iAddr, iLen;
+	int rc;
+	ee_async_cb pfnDone;
+	void *pUser;
+	unsigned char ucData[EE_ASYNC_MAX_WRITE];
+} ee_async_req;
+
+typedef struct ee_async_slot {
+	atomic_size_t ulSeq;
+	ee_async_req req;
+} ee_async_slot;
+
+struct ee_async {
+	ee_dev *pEE;
+	ee_async_slot *pSlots;
+	size_t ulMask; // queue depth - 1 (a power of 2)
+	atomic_size_t ulTail; // next position to fill
+	atomic_size_t ulHead; // next position to drain
+	ee_async_req *pBatch; // requests being written by the worker
+	sem_t sem; // posted for each request (and to stop)
+	atomic_int bRunning;
+	pthread_t thread;
+	pthread_mutex_t mutex; // protects the fields below
+	pthread_cond_t cond;
+	size_t ulDone; // requests completed
+	int bError; // a write failed since the last flush
+};
+
+//
+// Take the oldest request from the queue
+// returns 1 for success, 0 if it's empty
+//
+static int eeAsyncPop(ee_async *pAsync, ee_async_req *pReq)
+{
+ee_async_slot *pSlot;
+size_t ulPos, ulSeq;
+intptr_t iDiff;
+
+	ulPos = atomic_load_explicit(&pAsync->ulHead, memory_order_relaxed);
+	for (;;)
+	{
+		pSlot = &pAsync->pSlots[ulPos & pAsync->ulMask];
+		ulSeq = atomic_load_explicit(&pSlot->ulSeq, memory_order_acquire);
+		iDiff = (intptr_t)ulSeq - (intptr_t)(ulPos + 1);
+		if (iDiff == 0)
+		{
+			if (atomic_compare_exchange_weak_explicit(&pAsync->ulHead, &ulPos, ulPos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		else if (iDiff < 0) // not filled yet
+			return 0;
+		else
+			ulPos = atomic_load_explicit(&pAsync->ulHead, memory_order_relaxed);
+	}
+	memcpy(pReq, &pSlot->req, sizeof(ee_async_req) - EE_ASYNC_MAX_WRITE + pSlot->req.iLen);
+	atomic_store_explicit(&pSlot->ulSeq, ulPos + pAsync->ulMask + 1, memory_order_release);
+	return 1;
+} /* eeAsyncPop() */
+
+//
+// Does request i write to the given page?
+//
+static int eeAsyncTouches(ee_async *pAsync, int i, int iPage)
+{
+ee_async_req *pReq = &pAsync->pBatch[i];
+int iPageSize = pAsync->pEE->iPageSize;
+
+	return (pReq->iAddr / iPageSize <= iPage && (pReq->iAddr + pReq->iLen - 1) / iPageSize >= iPage);
+} /* eeAsyncTouches() */
+
+//
+// Write one page with every request of the batch which touches it,
+// starting from request iFirst (the first one which does)
+// returns 0 for success, -1 for error
+//
+static int eeAsyncWritePage(ee_async *pAsync, int iCount, int iFirst, int iPage)
+{
+unsigned char ucPage[EE_MAX_PAGE], ucSet[EE_MAX_PAGE];
+ee_async_req *pReq;
+int i, j, iLo, iHi, iStart, iEnd, iBase, rc = 0;
+
+	iBase = iPage * pAsync->pEE->iPageSize;
+	iLo = pAsync->pEE->iPageSize;
+	iHi = 0;
+	memset(ucSet, 0, sizeof(ucSet));
+	for (i=iFirst; i<iCount; i++)
+	{
+		if (!eeAsyncTouches(pAsync, i, iPage))
+			continue;
+		pReq = &pAsync->pBatch[i];
+		iStart = (pReq->iAddr > iBase) ? pReq->iAddr - iBase : 0;
+		iEnd = pReq->iAddr + pReq->iLen - iBase;
+		if (iEnd > pAsync->pEE->iPageSize)
+			iEnd = pAsync->pEE->iPageSize;
+		if (iStart < iLo) iLo = iStart;
+		if (iEnd > iHi) iHi = iEnd;
+		memset(&ucSet[iStart], 1, iEnd - iStart);
+	}
+	// a gap between the requests is filled with the current contents
+	for (j=iLo; j<iHi && ucSet[j]; j++) {};
+	if (j < iHi && eeDevRead(pAsync->pEE, iBase + iLo, &ucPage[iLo], iHi - iLo) != iHi - iLo)
+		rc = -1;
+	if (rc == 0)
+	{
+		for (i=iFirst; i<iCount; i++) // in order, so the newest data wins
+		{
+			if (!eeAsyncTouches(pAsync, i, iPage))
+				continue;
+			pReq = &pAsync->pBatch[i];
+			iStart = (pReq->iAddr > iBase) ? pReq->iAddr - iBase : 0;
+			iEnd = pReq->iAddr + pReq->iLen - iBase;
+			if (iEnd > pAsync->pEE->iPageSize)
+				iEnd = pAsync->pEE->iPageSize;
+			memcpy(&ucPage[iStart], &pReq->ucData[iBase + iStart - pReq->iAddr], iEnd - iStart);
+		}
+		if (eeDevWrite(pAsync->pEE, iBase + iLo, &ucPage[iLo], iHi - iLo) != iHi - iLo)
+			rc = -1;
+	}
+	if (rc != 0)
+	{
+		for (i=iFirst; i<iCount; i++)
+		{
+			if (eeAsyncTouches(pAsync, i, iPage))
+				pAsync->pBatch[i].rc = -1;
+		}
+	}
+	return rc;
+} /* eeAsyncWritePage() */
+
+//
+// Write a batch of requests, one page write per page touched
+//
+static void eeAsyncRun(ee_async *pAsync, int iCount)
+{
+ee_async_req *pReq;
+int i, j, iPage, iLast, iLastPage = -1, bError = 0;
+
+	for (i=0; i<iCount; i++)
+	{
+		pReq = &pAsync->pBatch[i];
+		iLast = (pReq->iAddr + pReq->iLen - 1) / pAsync->pEE->iPageSize;
+		for (iPage = pReq->iAddr / pAsync->pEE->iPageSize; iPage <= iLast; iPage++)
+		{
+			for (j=0; j<i && !eeAsyncTouches(pAsync, j, iPage); j++) {};
+			if (j < i) // already written with an earlier request
+				continue;
+			eeAsyncWritePage(pAsync, iCount, i, iPage);
+			iLastPage = iPage;
+		}
+	}
+	// the last write cycle is still running; the others were polled
+	// by the write which followed them
+	if (iLastPage >= 0 && eeDevWaitReady(pAsync->pEE, iLastPage * pAsync->pEE->iPageSize) != 0)
+	{
+		for (i=0; i<iCount; i++)
+		{
+			if (eeAsyncTouches(pAsync, i, iLastPage))
+				pAsync->pBatch[i].rc = -1;
+		}
+	}
+	for (i=0; i<iCount; i++)
+	{
+		pReq = &pAsync->pBatch[i];
+		if (pReq->rc != 0)
+			bError = 1;
+		if (pReq->pfnDone)
+			(*pReq->pfnDone)(pReq->pUser, pReq->iAddr, pReq->iLen, pReq->rc);
+	}
+	pthread_mutex_lock(&pAsync->mutex);
+	pAsync->ulDone += iCount;
+	pAsync->bError |= bError;
+	pthread_cond_broadcast(&pAsync->cond);
+	pthread_mutex_unlock(&pAsync->mutex);
+} /* eeAsyncRun() */
+
+//
+// Worker thread which drains the queue
+//
+static void *eeAsyncThread(void *pArg)
+{
+ee_async *pAsync = (ee_async *)pArg;
+int iCount;
+
+	for (;;)
+	{
+		sem_wait(&pAsync->sem);
+		iCount = 0;
+		while (iCount <= (int)pAsync->ulMask && eeAsyncPop(pAsync, &pAsync->pBatch[iCount]))
+			iCount++;
+		if (iCount)
+			eeAsyncRun(pAsync, iCount);
+		else if (!atomic_load(&pAsync->bRunning))
+			break;
+	}
+	return NULL;
+} /* eeAsyncThread() */
+
+//
+// Start an asynchronous write queue holding up to iDepth requests
+// (rounded up to a power of 2)
+// returns NULL for failure
+//
+ee_async *eeAsyncOpen(ee_dev *pEE, int iDepth)
+{
+ee_async *pAsync;
+size_t i, ulDepth;
+
+	if (pEE->iPageSize > EE_MAX_PAGE || iDepth < 1)
+		return NULL;
+	for (ulDepth = 2; ulDepth < (size_t)iDepth; ulDepth <<= 1) {};
+	pAsync = (ee_async *)calloc(1, sizeof(ee_async));
+	if (pAsync == NULL)
+		return NULL;
+	pAsync->pEE = pEE;
+	pAsync->ulMask = ulDepth - 1;
+	pAsync->pSlots = (ee_async_slot *)calloc(ulDepth, sizeof(ee_async_slot));
+	pAsync->pBatch = (ee_async_req *)calloc(ulDepth, sizeof(ee_async_req));
+	if (pAsync->pSlots == NULL || pAsync->pBatch == NULL)
+	{
+		free(pAsync->pSlots);
+		free(pAsync->pBatch);
+		free(pAsync);
+		return NULL;
+	}
+	for (i=0; i<ulDepth; i++)
+		atomic_init(&pAsync->pSlots[i].ulSeq, i);
+	atomic_init(&pAsync->ulTail, 0);
+	atomic_init(&pAsync->ulHead, 0);
+	atomic_init(&pAsync->bRunning, 1);
+	sem_init(&pAsync->sem, 0, 0);
+	pthread_mutex_init(&pAsync->mutex, NULL);
+	pthread_cond_init(&pAsync->cond, NULL);
+	if (pthread_create(&pAsync->thread, NULL, eeAsyncThread, pAsync) != 0)
+	{
+		sem_destroy(&pAsync->sem);
+		pthread_cond_destroy(&pAsync->cond);
+		pthread_mutex_destroy(&pAsync->mutex);
+		free(pAsync->pSlots);
+		free(pAsync->pBatch);
+		free(pAsync);
+		return NULL;
+	}
+	return pAsync;
+} /* eeAsyncOpen() */
+
+//
+// Finish the queued writes and stop the worker
+// returns the result of the final eeAsyncFlush()
+//
+int eeAsyncClose(ee_async *pAsync)
+{
+int rc;
+
+	if (pAsync == NULL)
+		return 0;
+	rc = eeAsyncFlush(pAsync);
+	atomic_store(&pAsync->bRunning, 0);
+	sem_post(&pAsync->sem);
+	pthread_join(pAsync->thread, NULL);
+	sem_destroy(&pAsync->sem);
+	pthread_cond_destroy(&pAsync->cond);
+	pthread_mutex_destroy(&pAsync->mutex);
+	free(pAsync->pSlots);
+	free(pAsync->pBatch);
+	free(pAsync);
+	return rc;
+} /* eeAsyncClose() */
+
+//
+// Queue a write of up to EE_ASYNC_MAX_WRITE bytes (it may cross pages)
+// The data is copied, and pfnDone (if not NULL) is called from the
+// worker thread once it's in the EEPROM, or has failed. Until then a
+// read of the same addresses still returns the old data.
+// Never blocks; returns 0 for success, -1 if the queue is full or
+// the request is invalid
+//
+int eeAsyncWrite(ee_async *pAsync, int iAddr, const unsigned char *pData, int iLen, ee_async_cb pfnDone, void *pUser)
+{
+ee_async_slot *pSlot;
+size_t ulPos, ulSeq;
+intptr_t iDiff;
+
+	if (iLen <= 0 || iLen > EE_ASYNC_MAX_WRITE || iAddr < 0 || iAddr + iLen > pAsync->pEE->iSize)
+		return -1;
+	ulPos = atomic_load_explicit(&pAsync->ulTail, memory_order_relaxed);
+	for (;;)
+	{
+		pSlot = &pAsync->pSlots[ulPos & pAsync->ulMask];
+		ulSeq = atomic_load_explicit(&pSlot->ulSeq, memory_order_acquire);
+		iDiff = (intptr_t)ulSeq - (intptr_t)ulPos;
+		if (iDiff == 0)
+		{
+			if (atomic_compare_exchange_weak_explicit(&pAsync->ulTail, &ulPos, ulPos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		else if (iDiff < 0) // full
+			return -1;
+		else
+			ulPos = atomic_load_explicit(&pAsync->ulTail, memory_order_relaxed);
+	}
+	pSlot->req.iAddr = iAddr;
+	pSlot->req.iLen = iLen;
+	pSlot->req.rc = 0;
+	pSlot->req.pfnDone = pfnDone;
+	pSlot->req.pUser = pUser;
+	memcpy(pSlot->req.ucData, pData, iLen);
+	atomic_store_explicit(&pSlot->ulSeq, ulPos + 1, memory_order_release);
+	sem_post(&pAsync->sem);
+	return 0;
+} /* eeAsyncWrite() */
+
+//
+// Wait until every write queued before this call has completed
+// (don't call it from a completion callback)
+// returns 0 if all of the writes since the previous flush succeeded,
+// -1 if any failed
+//
+int eeAsyncFlush(ee_async *pAsync)
+{
+size_t ulTarget;
+int rc;
+
+	ulTarget = atomic_load(&pAsync->ulTail);
+	pthread_mutex_lock(&pAsync->mutex);
+	while ((intptr_t)(pAsync->ulDone - ulTarget) < 0)
+		pthread_cond_wait(&pAsync->cond, &pAsync->mutex);
+	rc = (pAsync->bError) ? -1 : 0;
+	pAsync->bError = 0;
+	pthread_mutex_unlock(&pAsync->mutex);
+	return rc;
+} /* eeAsyncFlush() */
@@ -0,0 +1,252 @@
+//
+// DS3231 and xxx
+// Real Time Clock + EEPROM library
+// EEPROM write-back cache
+//
+// Mirrors the whole EEPROM in RAM with one sequential read, so reads
+// never touch the bus. Writes only change the copy and mark their pages
+// dirty; eeSync() (or the flush thread, once the oldest change is
+// iFlushMs old) programs each dirty page with a single page write, so
+// many small updates to the same page cost one write cycle.
+//
+// Written by Larry Bank
+// Copyright (c) 2018 BitBank Software, Inc.
+// bitbank@pobox.com
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "rtc.h"
+#include "rtc_priv.h"
+
+struct ee_cache {
+	ee_dev *pEE;
+	unsigned char *pData; // copy of the whole EEPROM
+	uint32_t *pDirty; // one bit per page
+	int iSize, iPageSize, iPages;
+	int iFlushMs; // flush deadline after the first change (0 = only eeSync)
+	int64_t llDirtyMs; // CLOCK_MONOTONIC time of the oldest unsaved change (0 = clean)
+	int bRunning; // flush thread is active
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+static int64_t eeCacheMs(void)
+{
+struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000LL) + (ts.tv_nsec / 1000000);
+} /* eeCacheMs() */
+
+//
+// Background thread which flushes the cache when the oldest
+// change reaches the deadline
+//
+static void *eeCacheThread(void *pArg)
+{
+ee_cache *pCache = (ee_cache *)pArg;
+struct timespec ts;
+int64_t llDeadline;
+
+	pthread_mutex_lock(&pCache->mutex);
+	while (pCache->bRunning)
+	{
+		if (pCache->llDirtyMs == 0) // nothing to do until something changes
+		{
+			pthread_cond_wait(&pCache->cond, &pCache->mutex);
+			continue;
+		}
+		llDeadline = pCache->llDirtyMs + pCache->iFlushMs;
+		if (eeCacheMs() < llDeadline)
+		{
+			ts.tv_sec = llDeadline / 1000;
+			ts.tv_nsec = (llDeadline % 1000) * 1000000;
+			pthread_cond_timedwait(&pCache->cond, &pCache->mutex, &ts);
+			continue;
+		}
+		pthread_mutex_unlock(&pCache->mutex);
+		if (eeSync(pCache) != 0) // don't spin on a dead device
+		{
+			pthread_mutex_lock(&pCache->mutex);
+			if (pCache->llDirtyMs)
+				pCache->llDirtyMs = eeCacheMs();
+			continue;
+		}
+		pthread_mutex_lock(&pCache->mutex);
+	}
+	pthread_mutex_unlock(&pCache->mutex);
+	return NULL;
+} /* eeCacheThread() */
+
+//
+// Load the whole EEPROM into a new cache
+// iFlushMs > 0 starts a thread which writes changes back at most
+// that long after they were made; 0 leaves it to eeSync()
+// returns NULL for failure
+//
+ee_cache *eeCacheOpen(ee_dev *pEE, int iFlushMs)
+{
+ee_cache *pCache;
+pthread_condattr_t attr;
+
+	if (pEE->iPageSize > EE_MAX_PAGE)
+		return NULL;
+	pCache = (ee_cache *)calloc(1, sizeof(ee_cache));
+	if (pCache == NULL)
+		return NULL;
+	pCache->pEE = pEE;
+	pCache->iSize = pEE->iSize;
+	pCache->iPageSize = pEE->iPageSize;
+	pCache->iPages = pEE->iSize / pEE->iPageSize;
+	pCache->iFlushMs = (iFlushMs > 0) ? iFlushMs : 0;
+	pCache->pData = (unsigned char *)malloc(pCache->iSize);
+	pCache->pDirty = (uint32_t *)calloc((pCache->iPages + 31) / 32, sizeof(uint32_t));
+	if (pCache->pData == NULL || pCache->pDirty == NULL ||
+		eeDevRead(pEE, 0, pCache->pData, pCache->iSize) != pCache->iSize)
+	{
+		free(pCache->pData);
+		free(pCache->pDirty);
+		free(pCache);
+		return NULL;
+	}
+	pthread_mutex_init(&pCache->mutex, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&pCache->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if (pCache->iFlushMs)
+	{
+		pCache->bRunning = 1;
+		if (pthread_create(&pCache->thread, NULL, eeCacheThread, pCache) != 0)
+		{
+			pCache->bRunning = 0; // there's no thread to join
+			eeCacheClose(pCache);
+			return NULL;
+		}
+	}
+	return pCache;
+} /* eeCacheOpen() */
+
+//
+// Write back any changes and free the cache
+// returns 0 for success, -1 if some changes could not be written
+//
+int eeCacheClose(ee_cache *pCache)
+{
+int rc;
+
+	if (pCache == NULL)
+		return 0;
+	pthread_mutex_lock(&pCache->mutex);
+	if (pCache->bRunning)
+	{
+		pCache->bRunning = 0;
+		pthread_cond_signal(&pCache->cond);
+		pthread_mutex_unlock(&pCache->mutex);
+		pthread_join(pCache->thread, NULL);
+	}
+	else
+	{
+		pthread_mutex_unlock(&pCache->mutex);
+	}
+	rc = eeSync(pCache);
+	pthread_cond_destroy(&pCache->cond);
+	pthread_mutex_destroy(&pCache->mutex);
+	free(pCache->pData);
+	free(pCache->pDirty);
+	free(pCache);
+	return rc;
+} /* eeCacheClose() */
+
+//
+// Read from the cached copy
+// returns the number of bytes read or -1 for error
+//
+int eeCacheRead(ee_cache *pCache, int iAddr, unsigned char *pData, int iLen)
+{
+	if (iAddr < 0 || iLen < 0 || iAddr + iLen > pCache->iSize)
+		return -1;
+	pthread_mutex_lock(&pCache->mutex);
+	memcpy(pData, &pCache->pData[iAddr], iLen);
+	pthread_mutex_unlock(&pCache->mutex);
+	return iLen;
+} /* eeCacheRead() */
+
+//
+// Direct read-only view of the cached copy
+// (a multi-byte value read from it can be torn by a concurrent
+// eeCacheWrite; use eeCacheRead when other threads write)
+//
+const unsigned char *eeCacheMap(ee_cache *pCache)
+{
+	return pCache->pData;
+} /* eeCacheMap() */
+
+//
+// Change the cached copy and mark the pages which really changed
+// returns the number of bytes written or -1 for error
+//
+int eeCacheWrite(ee_cache *pCache, int iAddr, unsigned char *pData, int iLen)
+{
+int i, iPage;
+
+	if (iAddr < 0 || iLen < 0 || iAddr + iLen > pCache->iSize)
+		return -1;
+	pthread_mutex_lock(&pCache->mutex);
+	for (i=0; i<iLen; i++)
+	{
+		if (pCache->pData[iAddr+i] != pData[i])
+		{
+			pCache->pData[iAddr+i] = pData[i];
+			iPage = (iAddr + i) / pCache->iPageSize;
+			pCache->pDirty[iPage >> 5] |= (1U << (iPage & 31));
+			if (pCache->llDirtyMs == 0)
+			{
+				pCache->llDirtyMs = eeCacheMs();
+				pthread_cond_signal(&pCache->cond); // start the deadline
+			}
+		}
+	}
+	pthread_mutex_unlock(&pCache->mutex);
+	return iLen;
+} /* eeCacheWrite() */
+
+//
+// Write every dirty page to the EEPROM
+// Each page is copied and marked clean before it's written, so other
+// threads can keep using the cache during the write cycles
+// returns 0 for success, -1 for error (the failed pages stay dirty)
+//
+int eeSync(ee_cache *pCache)
+{
+unsigned char ucPage[EE_MAX_PAGE];
+int iPage, iAddr, bFailed, rc = 0;
+
+	pthread_mutex_lock(&pCache->mutex);
+	pCache->llDirtyMs = 0;
+	for (iPage=0; iPage<pCache->iPages; iPage++)
+	{
+		if (!(pCache->pDirty[iPage >> 5] & (1U << (iPage & 31))))
+			continue;
+		pCache->pDirty[iPage >> 5] &= ~(1U << (iPage & 31));
+		iAddr = iPage * pCache->iPageSize;
+		memcpy(ucPage, &pCache->pData[iAddr], pCache->iPageSize);
+		pthread_mutex_unlock(&pCache->mutex);
+		bFailed = (eeDevWrite(pCache->pEE, iAddr, ucPage, pCache->iPageSize) != pCache->iPageSize);
+		pthread_mutex_lock(&pCache->mutex);
+		if (bFailed) // keep it for the next attempt
+		{
+			rc = -1;
+			pCache->pDirty[iPage >> 5] |= (1U << (iPage & 31));
+			if (pCache->llDirtyMs == 0)
+				pCache->llDirtyMs = eeCacheMs();
+		}
+	}
+	pthread_mutex_unlock(&pCache->mutex);
+	return rc;
+} /* eeSync() */
@@ -0,0 +1,541 @@
+//
+// DS3231 and xxx
+// Real Time Clock + EEPROM library
+// Wear-leveled key/value store
+//
+// Settings are appended as records to a circular log of EEPROM pages
+// instead of being rewritten in place, so the writes move across the
+// whole region and a brown-out can only damage the record being written
+// (its CRC fails and the previous version is used).
+//
+// Each record starts on a page boundary and never wraps past the end:
+//   0    magic
+//   1    flags (KV_DELETED)
+//   2    key length
+//   3    value length
+//   4-7  sequence number (little endian, +1 per record)
+//   8-9  oldest page of the log when it was written
+//   key, value, CRC-32 of everything before it
+//
+// Mounting reads the region with one bulk read, finds the newest
+// record and walks the log from the oldest page it names, building an
+// index of the latest record of each key. Sequence numbers must rise
+// along the way, so leftovers from earlier passes are ignored.
+// When space runs out, the record at the tail is dropped if it's stale
+// or copied to the head if it's still current.
+//
+// Written by Larry Bank
+// Copyright (c) 2018 BitBank Software, Inc.
+// bitbank@pobox.com
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "rtc.h"
+#include "rtc_priv.h"
+
+#define KV_MAGIC 0x4b
+#define KV_DELETED 1
+#define KV_HDR 10
+#define KV_MAX_RECORD (KV_HDR + EE_KV_MAX_KEY + EE_KV_MAX_VALUE + 4)
+
+typedef struct kv_entry {
+	uint32_t ulHash; // of the key
+	uint32_t ulSeq; // sequence number of its latest record
+	uint16_t usPage; // where that record starts
+	uint8_t ucPages; // pages it takes
+	uint8_t ucLen; // value length
+} kv_entry;
+
+struct ee_kv {
+	ee_dev *pEE;
+	int iStart; // EEPROM address of the first page
+	int iPageSize, iPages;
+	int iHead; // next page to write
+	int iTail; // oldest page of the log
+	int iUsed; // pages from the tail to the head
+	int iGap; // unused end pages skipped when the head wrapped (-1 = none)
+	int iLive; // pages holding the current records
+	int iReserve; // pages kept free so the tail can always be moved
+	uint32_t ulSeq; // next sequence number
+	kv_entry *pIndex;
+	int iCount, iSize;
+	pthread_mutex_t mutex;
+};
+
+static int eeKvAppend(ee_kv *pKV, unsigned char *ucRec, int iLen, int iSpare, int *pPage, uint32_t *pSeq);
+
+//
+// FNV-1a hash of a key
+//
+static uint32_t eeKvHash(const unsigned char *pKey, int iLen)
+{
+uint32_t ulHash = 2166136261U;
+
+	while (iLen--)
+		ulHash = (ulHash ^ *pKey++) * 16777619U;
+	return ulHash;
+} /* eeKvHash() */
+
+static int eeKvPages(ee_kv *pKV, int iBytes)
+{
+	return (iBytes + pKV->iPageSize - 1) / pKV->iPageSize;
+} /* eeKvPages() */
+
+static uint32_t eeKvSeq(unsigned char *pRec)
+{
+	return pRec[4] | (pRec[5] << 8) | (pRec[6] << 16) | ((uint32_t)pRec[7] << 24);
+} /* eeKvSeq() */
+
+//
+// Check for an intact record
+// returns its length in bytes or 0 if there isn't one
+//
+static int eeKvCheck(unsigned char *pRec, int iAvail)
+{
+int iLen;
+uint32_t ulCrc;
+
+	if (iAvail < KV_HDR + 5 || pRec[0] != KV_MAGIC || pRec[2] == 0 ||
+		pRec[2] > EE_KV_MAX_KEY || pRec[3] > EE_KV_MAX_VALUE)
+		return 0;
+	iLen = KV_HDR + pRec[2] + pRec[3];
+	if (iLen + 4 > iAvail)
+		return 0;
+	ulCrc = pRec[iLen] | (pRec[iLen+1] << 8) | (pRec[iLen+2] << 16) | ((uint32_t)pRec[iLen+3] << 24);
+	return (eeCrc32(0, pRec, iLen) == ulCrc) ? iLen + 4 : 0;
+} /* eeKvCheck() */
+
+//
+// Find the index entry of a key
+// The record is compared from pMem (the mount buffer) or read into
+// ucRec, where it's left for the caller
+// returns the entry number or -1 if not found
+//
+static int eeKvFind(ee_kv *pKV, const unsigned char *pKey, int iKeyLen, uint32_t ulHash, unsigned char *pMem, unsigned char *ucRec)
+{
+kv_entry *pEntry;
+unsigned char *pRec;
+int i, iLen;
+
+	for (i=0; i<pKV->iCount; i++)
+	{
+		pEntry = &pKV->pIndex[i];
+		if (pEntry->ulHash != ulHash)
+			continue;
+		iLen = KV_HDR + iKeyLen + pEntry->ucLen;
+		if (pMem)
+		{
+			pRec = &pMem[pEntry->usPage * pKV->iPageSize];
+		}
+		else
+		{
+			if (eeDevRead(pKV->pEE, pKV->iStart + (pEntry->usPage * pKV->iPageSize), ucRec, iLen) != iLen)
+				continue;
+			pRec = ucRec;
+		}
+		if (pRec[2] == iKeyLen && memcmp(&pRec[KV_HDR], pKey, iKeyLen) == 0)
+			return i;
+	}
+	return -1;
+} /* eeKvFind() */
+
+static void eeKvRemove(ee_kv *pKV, int i)
+{
+	pKV->iLive -= pKV->pIndex[i].ucPages;
+	pKV->pIndex[i] = pKV->pIndex[--pKV->iCount];
+} /* eeKvRemove() */
+
+//
+// Add a key to the index
+// returns the entry number or -1 for error
+//
+static int eeKvAdd(ee_kv *pKV, uint32_t ulHash)
+{
+kv_entry *pNew;
+
+	if (pKV->iCount == pKV->iSize)
+	{
+		pNew = (kv_entry *)realloc(pKV->pIndex, (pKV->iSize + 16) * sizeof(kv_entry));
+		if (pNew == NULL)
+			return -1;
+		pKV->pIndex = pNew;
+		pKV->iSize += 16;
+	}
+	memset(&pKV->pIndex[pKV->iCount], 0, sizeof(kv_entry));
+	pKV->pIndex[pKV->iCount].ulHash = ulHash;
+	return pKV->iCount++;
+} /* eeKvAdd() */
+
+//
+// Point an entry at a new record
+//
+static void eeKvUpdate(ee_kv *pKV, int i, int iPage, uint32_t ulSeq, int iLen, int iValueLen)
+{
+kv_entry *pEntry = &pKV->pIndex[i];
+
+	pKV->iLive += eeKvPages(pKV, iLen) - pEntry->ucPages;
+	pEntry->usPage = (uint16_t)iPage;
+	pEntry->ulSeq = ulSeq;
+	pEntry->ucPages = (uint8_t)eeKvPages(pKV, iLen);
+	pEntry->ucLen = (uint8_t)iValueLen;
+} /* eeKvUpdate() */
+
+//
+// Move the tail forward by iPages
+// (reclaiming the skipped pages at the end when it gets there)
+//
+static void eeKvAdvance(ee_kv *pKV, int iPages)
+{
+	pKV->iTail += iPages;
+	pKV->iUsed -= iPages;
+	if (pKV->iGap >= 0 && pKV->iTail >= pKV->iGap)
+	{
+		pKV->iUsed -= pKV->iPages - pKV->iTail;
+		pKV->iTail = pKV->iPages;
+		pKV->iGap = -1;
+	}
+	if (pKV->iTail >= pKV->iPages)
+		pKV->iTail = 0;
+} /* eeKvAdvance() */
+
+//
+// Free the record at the tail; if it's still current, it's
+// copied to the head first
+// returns 0 for success, -1 for error
+//
+static int eeKvCollect(ee_kv *pKV)
+{
+unsigned char ucRec[KV_MAX_RECORD];
+int i, iLen, iAvail, iPage;
+uint32_t ulSeq;
+
+	if (pKV->iUsed == 0)
+		return -1;
+	iAvail = (pKV->iPages - pKV->iTail) * pKV->iPageSize;
+	if (iAvail > KV_MAX_RECORD)
+		iAvail = KV_MAX_RECORD;
+	if (eeDevRead(pKV->pEE, pKV->iStart + (pKV->iTail * pKV->iPageSize), ucRec, iAvail) != iAvail)
+		return -1;
+	iLen = eeKvCheck(ucRec, iAvail);
+	if (iLen == 0 || eeKvPages(pKV, iLen) > pKV->iUsed) // skipped or torn page
+	{
+		eeKvAdvance(pKV, 1);
+		return 0;
+	}
+	for (i=0; i<pKV->iCount; i++)
+	{
+		if (pKV->pIndex[i].usPage == pKV->iTail && pKV->pIndex[i].ulSeq == eeKvSeq(ucRec))
+			break;
+	}
+	eeKvAdvance(pKV, eeKvPages(pKV, iLen));
+	if (i == pKV->iCount) // stale
+		return 0;
+	if (eeKvAppend(pKV, ucRec, iLen - 4, 0, &iPage, &ulSeq) != 0)
+		return -1;
+	eeKvUpdate(pKV, i, iPage, ulSeq, iLen, ucRec[3]);
+	return 0;
+} /* eeKvCollect() */
+
+//
+// Collect at the tail until iPages contiguous pages are free at the
+// head, with iSpare more free pages left over
+// returns 0 for success, -1 for error
+//
+static int eeKvMakeRoom(ee_kv *pKV, int iPages, int iSpare)
+{
+int i;
+
+	for (i=0; i<pKV->iPages * 2; i++)
+	{
+		if (pKV->iUsed == 0) // start over from the beginning
+		{
+			pKV->iHead = pKV->iTail = 0;
+			pKV->iGap = -1;
+		}
+		if (pKV->iPages - pKV->iUsed >= iPages + iSpare)
+		{
+			if (pKV->iHead < pKV->iTail || pKV->iPages - pKV->iHead >= iPages)
+				return 0; // it fits at the head
+			if (pKV->iTail >= iPages) // skip the end pages and continue from page 0
+			{
+				pKV->iGap = pKV->iHead;
+				pKV->iUsed += pKV->iPages - pKV->iHead;
+				pKV->iHead = 0;
+				continue;
+			}
+		}
+		if (eeKvCollect(pKV) != 0)
+			return -1;
+	}
+	return -1;
+} /* eeKvMakeRoom() */
+
+//
+// Write a record (header fields from byte 1 on, key and value already
+// filled in) at the head
+// returns 0 for success, -1 for error
+//
+static int eeKvAppend(ee_kv *pKV, unsigned char *ucRec, int iLen, int iSpare, int *pPage, uint32_t *pSeq)
+{
+uint32_t ulCrc;
+int iPages;
+
+	iPages = eeKvPages(pKV, iLen + 4);
+	if (eeKvMakeRoom(pKV, iPages, iSpare) != 0)
+		return -1;
+	*pSeq = pKV->ulSeq++;
+	ucRec[0] = KV_MAGIC;
+	ucRec[4] = (unsigned char)*pSeq;
+	ucRec[5] = (unsigned char)(*pSeq >> 8);
+	ucRec[6] = (unsigned char)(*pSeq >> 16);
+	ucRec[7] = (unsigned char)(*pSeq >> 24);
+	ucRec[8] = (unsigned char)pKV->iTail;
+	ucRec[9] = (unsigned char)(pKV->iTail >> 8);
+	ulCrc = eeCrc32(0, ucRec, iLen);
+	ucRec[iLen] = (unsigned char)ulCrc;
+	ucRec[iLen+1] = (unsigned char)(ulCrc >> 8);
+	ucRec[iLen+2] = (unsigned char)(ulCrc >> 16);
+	ucRec[iLen+3] = (unsigned char)(ulCrc >> 24);
+	if (eeDevWrite(pKV->pEE, pKV->iStart + (pKV->iHead * pKV->iPageSize), ucRec, iLen + 4) != iLen + 4)
+		return -1;
+	*pPage = pKV->iHead;
+	pKV->iHead += iPages;
+	pKV->iUsed += iPages;
+	if (pKV->iHead == pKV->iPages)
+		pKV->iHead = 0;
+	return 0;
+} /* eeKvAppend() */
+
+//
+// Rebuild the state from the EEPROM contents
+// returns 0 for success, -1 for error
+//
+static int eeKvScan(ee_kv *pKV, unsigned char *pMem)
+{
+unsigned char *pRec;
+int i, iLen, iPage, iPages, iNewest = -1, iDist, bFirst = 1;
+uint32_t ulSeq, ulNewest = 0, ulPrev = 0;
+
+	// the newest intact record names the tail of the log
+	for (iPage=0; iPage<pKV->iPages; )
+	{
+		pRec = &pMem[iPage * pKV->iPageSize];
+		iLen = eeKvCheck(pRec, (pKV->iPages - iPage) * pKV->iPageSize);
+		if (iLen == 0)
+		{
+			iPage++;
+			continue;
+		}
+		ulSeq = eeKvSeq(pRec);
+		if (iNewest < 0 || ulSeq > ulNewest)
+		{
+			iNewest = iPage;
+			ulNewest = ulSeq;
+		}
+		iPage += eeKvPages(pKV, iLen);
+	}
+	pKV->iGap = -1;
+	if (iNewest < 0) // empty
+	{
+		pKV->iHead = pKV->iTail = pKV->iUsed = 0;
+		pKV->ulSeq = 1;
+		return 0;
+	}
+	pRec = &pMem[iNewest * pKV->iPageSize];
+	pKV->ulSeq = ulNewest + 1;
+	pKV->iHead = iNewest + eeKvPages(pKV, eeKvCheck(pRec, (pKV->iPages - iNewest) * pKV->iPageSize));
+	if (pKV->iHead == pKV->iPages)
+		pKV->iHead = 0;
+	pKV->iTail = pRec[8] | (pRec[9] << 8);
+	if (pKV->iTail >= pKV->iPages)
+		pKV->iTail = iNewest;
+	pKV->iUsed = (pKV->iHead - pKV->iTail + pKV->iPages) % pKV->iPages;
+	if (pKV->iUsed == 0)
+		pKV->iUsed = pKV->iPages;
+
+	// replay the log in order; the sequence numbers must keep rising,
+	// which rejects leftovers of older passes
+	iPage = pKV->iTail;
+	for (iDist=0; iDist<pKV->iUsed; iDist+=iPages)
+	{
+		pRec = &pMem[iPage * pKV->iPageSize];
+		iLen = eeKvCheck(pRec, (pKV->iPages - iPage) * pKV->iPageSize);
+		ulSeq = (iLen) ? eeKvSeq(pRec) : 0;
+		if (iLen && (bFirst || ulSeq > ulPrev) && ulSeq <= ulNewest)
+		{
+			bFirst = 0;
+			ulPrev = ulSeq;
+			iPages = eeKvPages(pKV, iLen);
+			i = eeKvFind(pKV, &pRec[KV_HDR], pRec[2], eeKvHash(&pRec[KV_HDR], pRec[2]), pMem, NULL);
+			if (pRec[1] & KV_DELETED)
+			{
+				if (i >= 0)
+					eeKvRemove(pKV, i);
+			}
+			else
+			{
+				if (i < 0 && (i = eeKvAdd(pKV, eeKvHash(&pRec[KV_HDR], pRec[2]))) < 0)
+					return -1;
+				eeKvUpdate(pKV, i, iPage, ulSeq, iLen, pRec[3]);
+			}
+		}
+		else // skipped end pages, a torn write or an old leftover
+		{
+			iPages = 1;
+		}
+		iPage += iPages;
+		if (iPage >= pKV->iPages)
+			iPage -= pKV->iPages;
+	}
+	return 0;
+} /* eeKvScan() */
+
+//
+// Mount the store kept in iLen bytes of the EEPROM from iStart
+// (both multiples of the page size; iLen = 0 means up to the end)
+// An erased or new region is an empty store
+// returns NULL for failure
+//
+ee_kv *eeKvMount(ee_dev *pEE, int iStart, int iLen)
+{
+ee_kv *pKV;
+unsigned char *pMem;
+
+	if (iLen == 0)
+		iLen = pEE->iSize - iStart;
+	if (iStart < 0 || iLen <= 0 || iStart + iLen > pEE->iSize ||
+		(iStart % pEE->iPageSize) || (iLen % pEE->iPageSize))
+		return NULL;
+	pKV = (ee_kv *)calloc(1, sizeof(ee_kv));
+	if (pKV == NULL)
+		return NULL;
+	pKV->pEE = pEE;
+	pKV->iStart = iStart;
+	pKV->iPageSize = pEE->iPageSize;
+	pKV->iPages = iLen / pEE->iPageSize;
+	// room to move the largest record while writing another
+	pKV->iReserve = 3 * eeKvPages(pKV, KV_MAX_RECORD);
+	pMem = (unsigned char *)malloc(iLen);
+	if (pKV->iPages > 65535 || pKV->iPages < pKV->iReserve * 2 || pMem == NULL ||
+		eeDevRead(pEE, iStart, pMem, iLen) != iLen || eeKvScan(pKV, pMem) != 0)
+	{
+		free(pMem);
+		free(pKV->pIndex);
+		free(pKV);
+		return NULL;
+	}
+	free(pMem);
+	pthread_mutex_init(&pKV->mutex, NULL);
+	return pKV;
+} /* eeKvMount() */
+
+void eeKvUnmount(ee_kv *pKV)
+{
+	if (pKV == NULL)
+		return;
+	pthread_mutex_destroy(&pKV->mutex);
+	free(pKV->pIndex);
+	free(pKV);
+} /* eeKvUnmount() */
+
+//
+// Read the value of a key
+// returns its length (which may be more than iMax; only iMax bytes
+// are copied) or -1 if it doesn't exist
+//
+int eeKvGet(ee_kv *pKV, const char *szKey, unsigned char *pValue, int iMax)
+{
+unsigned char ucRec[KV_MAX_RECORD];
+int i, iKeyLen, iLen = -1;
+
+	iKeyLen = (int)strlen(szKey);
+	if (iKeyLen == 0 || iKeyLen > EE_KV_MAX_KEY)
+		return -1;
+	pthread_mutex_lock(&pKV->mutex);
+	i = eeKvFind(pKV, (const unsigned char *)szKey, iKeyLen, eeKvHash((const unsigned char *)szKey, iKeyLen), NULL, ucRec);
+	if (i >= 0)
+	{
+		iLen = ucRec[3];
+		memcpy(pValue, &ucRec[KV_HDR + iKeyLen], (iLen < iMax) ? iLen : iMax);
+	}
+	pthread_mutex_unlock(&pKV->mutex);
+	return iLen;
+} /* eeKvGet() */
+
+//
+// Store a value (up to EE_KV_MAX_VALUE bytes) under a key
+// (up to EE_KV_MAX_KEY characters); nothing is written if the value
+// doesn't change
+// returns 0 for success, -1 for error (e.g. the store is full)
+//
+int eeKvSet(ee_kv *pKV, const char *szKey, const unsigned char *pValue, int iLen)
+{
+unsigned char ucRec[KV_MAX_RECORD];
+int i, iKeyLen, iPage, iPages, rc = -1;
+uint32_t ulHash, ulSeq;
+
+	iKeyLen = (int)strlen(szKey);
+	if (iKeyLen == 0 || iKeyLen > EE_KV_MAX_KEY || iLen < 0 || iLen > EE_KV_MAX_VALUE)
+		return -1;
+	ulHash = eeKvHash((const unsigned char *)szKey, iKeyLen);
+	pthread_mutex_lock(&pKV->mutex);
+	i = eeKvFind(pKV, (const unsigned char *)szKey, iKeyLen, ulHash, NULL, ucRec);
+	if (i >= 0 && ucRec[3] == iLen && memcmp(&ucRec[KV_HDR + iKeyLen], pValue, iLen) == 0)
+	{
+		rc = 0; // unchanged
+		goto done;
+	}
+	iPages = eeKvPages(pKV, KV_HDR + iKeyLen + iLen + 4);
+	if (pKV->iLive - ((i >= 0) ? pKV->pIndex[i].ucPages : 0) + iPages > pKV->iPages - pKV->iReserve)
+		goto done; // full
+	ucRec[1] = 0;
+	ucRec[2] = (unsigned char)iKeyLen;
+	ucRec[3] = (unsigned char)iLen;
+	memcpy(&ucRec[KV_HDR], szKey, iKeyLen);
+	memcpy(&ucRec[KV_HDR + iKeyLen], pValue, iLen);
+	if (eeKvAppend(pKV, ucRec, KV_HDR + iKeyLen + iLen, pKV->iReserve / 3, &iPage, &ulSeq) != 0)
+		goto done;
+	// (collecting may move entries but never removes them)
+	if (i < 0 && (i = eeKvAdd(pKV, ulHash)) < 0)
+		goto done;
+	eeKvUpdate(pKV, i, iPage, ulSeq, KV_HDR + iKeyLen + iLen + 4, iLen);
+	rc = 0;
+done:
+	pthread_mutex_unlock(&pKV->mutex);
+	return rc;
+} /* eeKvSet() */
+
+//
+// Remove a key
+// returns 0 for success, -1 if it doesn't exist or for error
+//
+int eeKvDelete(ee_kv *pKV, const char *szKey)
+{
+unsigned char ucRec[KV_MAX_RECORD];
+int i, iKeyLen, iPage, rc = -1;
+uint32_t ulSeq;
+
+	iKeyLen = (int)strlen(szKey);
+	if (iKeyLen == 0 || iKeyLen > EE_KV_MAX_KEY)
+		return -1;
+	pthread_mutex_lock(&pKV->mutex);
+	i = eeKvFind(pKV, (const unsigned char *)szKey, iKeyLen, eeKvHash((const unsigned char *)szKey, iKeyLen), NULL, ucRec);
+	if (i >= 0)
+	{
+		// a tombstone hides the older records until they're collected
+		ucRec[1] = KV_DELETED;
+		ucRec[2] = (unsigned char)iKeyLen;
+		ucRec[3] = 0;
+		memcpy(&ucRec[KV_HDR], szKey, iKeyLen);
+		if (eeKvAppend(pKV, ucRec, KV_HDR + iKeyLen, pKV->iReserve / 3, &iPage, &ulSeq) == 0)
+		{
+			eeKvRemove(pKV, i);
+			rc = 0;
+		}
+	}
+	pthread_mutex_unlock(&pKV->mutex);
+	return rc;
+} /* eeKvDelete() */
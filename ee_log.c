@@ -0,0 +1,387 @@
+//
+// DS3231 and xxx
+// Real Time Clock + EEPROM library
+// Ring buffer data logger
+//
+// Records are collected in RAM and written a whole EEPROM page at a
+// time around a ring of pages; once it's full the oldest page is
+// overwritten. Every page starts with a small header:
+//   0-3  sequence number (little endian, +1 per page written)
+//   4-7  base time (RTC seconds since 1970)
+//   8    payload bytes used
+//   9-10 low 16 bits of the CRC-32 of bytes 0-8 and the payload
+// followed by the records:
+//   length (only for variable length logs), seconds after the base
+//   time (16 bits), data
+//
+// Pages are written in order, so the sequence numbers run up from
+// page 0 to the newest page; opening finds it with a binary search
+// over the page headers instead of reading the whole device.
+//
+// Written by Larry Bank
+// Copyright (c) 2018 BitBank Software, Inc.
+// bitbank@pobox.com
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "rtc.h"
+#include "rtc_priv.h"
+
+#define LOG_HDR 11
+#define LOG_READ_PAGES 8 // pages per read when iterating
+
+struct ee_log {
+	ee_dev *pEE;
+	rtc_dev *pRTC; // time source (NULL = system time)
+	int iStart; // EEPROM address of the first page
+	int iPageSize, iPages;
+	int iRecLen; // fixed record length or 0 for variable
+	int iHead; // next page to write
+	int bWrapped; // every page has been written (iHead is the oldest)
+	uint32_t ulSeq; // sequence number of the page being filled
+	uint32_t ulBase; // its base time
+	int iUsed; // its payload bytes
+	unsigned char ucPage[EE_MAX_PAGE];
+	pthread_mutex_t mutex;
+};
+
+static uint32_t eeLogGet32(unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+} /* eeLogGet32() */
+
+static void eeLogPut32(unsigned char *p, uint32_t ul)
+{
+	p[0] = (unsigned char)ul;
+	p[1] = (unsigned char)(ul >> 8);
+	p[2] = (unsigned char)(ul >> 16);
+	p[3] = (unsigned char)(ul >> 24);
+} /* eeLogPut32() */
+
+//
+// Check the header and CRC of a page
+// returns 1 if it's intact
+//
+static int eeLogValid(ee_log *pLog, unsigned char *pPage)
+{
+uint32_t ulCrc;
+
+	if (pPage[8] > pLog->iPageSize - LOG_HDR)
+		return 0;
+	ulCrc = eeCrc32(0, pPage, 9);
+	ulCrc = eeCrc32(ulCrc, &pPage[LOG_HDR], pPage[8]);
+	return ((ulCrc & 0xffff) == (uint32_t)(pPage[9] | (pPage[10] << 8)));
+} /* eeLogValid() */
+
+//
+// Read the sequence number of a page
+// returns 0 for success, -1 for error
+//
+static int eeLogSeq(ee_log *pLog, int iPage, uint32_t *pSeq)
+{
+unsigned char ucTemp[4];
+
+	if (eeDevRead(pLog->pEE, pLog->iStart + (iPage * pLog->iPageSize), ucTemp, 4) != 4)
+		return -1;
+	*pSeq = eeLogGet32(ucTemp);
+	return 0;
+} /* eeLogSeq() */
+
+//
+// Read a whole page and check it
+// returns 1 if it's intact, 0 if not, -1 for error
+//
+static int eeLogReadPage(ee_log *pLog, int iPage, unsigned char *pPage)
+{
+	if (eeDevRead(pLog->pEE, pLog->iStart + (iPage * pLog->iPageSize), pPage, pLog->iPageSize) != pLog->iPageSize)
+		return -1;
+	return eeLogValid(pLog, pPage);
+} /* eeLogReadPage() */
+
+//
+// Find the newest page
+// returns 0 for success, -1 for error
+//
+static int eeLogRecover(ee_log *pLog)
+{
+unsigned char ucPage[EE_MAX_PAGE];
+uint32_t ulSeq0, ulSeq;
+int rc, iLow, iHigh, iMid;
+
+	rc = eeLogReadPage(pLog, 0, ucPage);
+	if (rc < 0)
+		return -1;
+	if (rc == 0)
+	{
+		// Page 0 is blank or was being rewritten; in the second case the
+		// last page is the newest intact one
+		rc = eeLogReadPage(pLog, pLog->iPages - 1, ucPage);
+		if (rc < 0)
+			return -1;
+		pLog->iHead = 0;
+		pLog->bWrapped = rc;
+		pLog->ulSeq = (rc) ? eeLogGet32(ucPage) + 1 : 1;
+		return 0;
+	}
+	// the pages of the current pass have sequence numbers ulSeq0 + page
+	ulSeq0 = eeLogGet32(ucPage);
+	iLow = 0;
+	iHigh = pLog->iPages - 1;
+	while (iLow < iHigh)
+	{
+		iMid = (iLow + iHigh + 1) / 2;
+		if (eeLogSeq(pLog, iMid, &ulSeq) != 0)
+			return -1;
+		if (ulSeq == ulSeq0 + iMid)
+			iLow = iMid;
+		else
+			iHigh = iMid - 1;
+	}
+	// a page torn by a power failure is written again
+	rc = eeLogReadPage(pLog, iLow, ucPage);
+	if (rc < 0)
+		return -1;
+	pLog->iHead = (rc) ? iLow + 1 : iLow;
+	pLog->ulSeq = ulSeq0 + pLog->iHead;
+	if (iLow == pLog->iPages - 1)
+	{
+		pLog->iHead %= pLog->iPages;
+		pLog->bWrapped = 1;
+	}
+	else
+	{
+		// did the previous pass leave pages after it?
+		if (eeLogSeq(pLog, iLow + 1, &ulSeq) != 0)
+			return -1;
+		pLog->bWrapped = (ulSeq == ulSeq0 + iLow + 1 - pLog->iPages);
+	}
+	return 0;
+} /* eeLogRecover() */
+
+//
+// Write the page being filled and start the next one
+// returns 0 for success, -1 for error
+//
+static int eeLogWritePage(ee_log *pLog)
+{
+uint32_t ulCrc;
+
+	if (pLog->iUsed == 0)
+		return 0;
+	eeLogPut32(pLog->ucPage, pLog->ulSeq);
+	eeLogPut32(&pLog->ucPage[4], pLog->ulBase);
+	pLog->ucPage[8] = (unsigned char)pLog->iUsed;
+	ulCrc = eeCrc32(0, pLog->ucPage, 9);
+	ulCrc = eeCrc32(ulCrc, &pLog->ucPage[LOG_HDR], pLog->iUsed);
+	pLog->ucPage[9] = (unsigned char)ulCrc;
+	pLog->ucPage[10] = (unsigned char)(ulCrc >> 8);
+	memset(&pLog->ucPage[LOG_HDR + pLog->iUsed], 0xff, pLog->iPageSize - LOG_HDR - pLog->iUsed);
+	if (eeDevWrite(pLog->pEE, pLog->iStart + (pLog->iHead * pLog->iPageSize), pLog->ucPage, pLog->iPageSize) != pLog->iPageSize)
+		return -1;
+	pLog->ulSeq++;
+	pLog->iUsed = 0;
+	if (++pLog->iHead == pLog->iPages)
+	{
+		pLog->iHead = 0;
+		pLog->bWrapped = 1;
+	}
+	return 0;
+} /* eeLogWritePage() */
+
+//
+// Open the log kept in iLen bytes of the EEPROM from iStart (page
+// aligned; iLen = 0 means up to the end)
+// Records are stamped with the time of pRTC (NULL = system time).
+// iRecLen > 0 stores fixed length records without a length byte; the
+// same value must be used every time the log is opened
+// returns NULL for failure
+//
+ee_log *eeLogOpen(ee_dev *pEE, rtc_dev *pRTC, int iStart, int iLen, int iRecLen)
+{
+ee_log *pLog;
+
+	if (iLen == 0)
+		iLen = pEE->iSize - iStart;
+	if (iStart < 0 || iLen < 2 * pEE->iPageSize || iStart + iLen > pEE->iSize ||
+		(iStart % pEE->iPageSize) || (iLen % pEE->iPageSize) ||
+		pEE->iPageSize > EE_MAX_PAGE || pEE->iPageSize < LOG_HDR + 4 || // 16 byte pages or more
+		iRecLen < 0 || iRecLen > pEE->iPageSize - LOG_HDR - 2)
+		return NULL;
+	pLog = (ee_log *)calloc(1, sizeof(ee_log));
+	if (pLog == NULL)
+		return NULL;
+	pLog->pEE = pEE;
+	pLog->pRTC = pRTC;
+	pLog->iStart = iStart;
+	pLog->iPageSize = pEE->iPageSize;
+	pLog->iPages = iLen / pEE->iPageSize;
+	pLog->iRecLen = iRecLen;
+	if (eeLogRecover(pLog) != 0)
+	{
+		free(pLog);
+		return NULL;
+	}
+	pthread_mutex_init(&pLog->mutex, NULL);
+	return pLog;
+} /* eeLogOpen() */
+
+//
+// Write out the records still in RAM and close the log
+// returns 0 for success, -1 if they couldn't be written
+//
+int eeLogClose(ee_log *pLog)
+{
+int rc;
+
+	if (pLog == NULL)
+		return 0;
+	rc = eeLogFlush(pLog);
+	pthread_mutex_destroy(&pLog->mutex);
+	free(pLog);
+	return rc;
+} /* eeLogClose() */
+
+//
+// Largest record which fits in a page
+//
+int eeLogMaxRecord(ee_log *pLog)
+{
+	return (pLog->iRecLen) ? pLog->iRecLen : pLog->iPageSize - LOG_HDR - 3;
+} /* eeLogMaxRecord() */
+
+//
+// Add a record stamped with the current time
+// It's kept in RAM until its page is full (or eeLogFlush)
+// returns 0 for success, -1 for error
+//
+int eeLogAppend(ee_log *pLog, const unsigned char *pData, int iLen)
+{
+int64_t llTime;
+uint32_t ulTime;
+int iSize, rc = 0;
+
+	if ((pLog->iRecLen && iLen != pLog->iRecLen) || iLen < 0 || iLen > eeLogMaxRecord(pLog))
+		return -1;
+	if (pLog->pRTC)
+	{
+		llTime = rtcNow(pLog->pRTC);
+		if (llTime < 0)
+			return -1;
+		ulTime = (uint32_t)(llTime / 1000000000LL);
+	}
+	else
+	{
+		ulTime = (uint32_t)time(NULL);
+	}
+	iSize = iLen + ((pLog->iRecLen) ? 2 : 3);
+	pthread_mutex_lock(&pLog->mutex);
+	// start a new page when it's full or the time doesn't fit 16 bits
+	if (pLog->iUsed && (pLog->iUsed + iSize > pLog->iPageSize - LOG_HDR ||
+		ulTime < pLog->ulBase || ulTime - pLog->ulBase > 0xffff))
+		rc = eeLogWritePage(pLog);
+	if (rc == 0)
+	{
+		if (pLog->iUsed == 0)
+			pLog->ulBase = ulTime;
+		iSize = LOG_HDR + pLog->iUsed;
+		if (!pLog->iRecLen)
+			pLog->ucPage[iSize++] = (unsigned char)iLen;
+		pLog->ucPage[iSize++] = (unsigned char)(ulTime - pLog->ulBase);
+		pLog->ucPage[iSize++] = (unsigned char)((ulTime - pLog->ulBase) >> 8);
+		memcpy(&pLog->ucPage[iSize], pData, iLen);
+		pLog->iUsed = iSize + iLen - LOG_HDR;
+	}
+	pthread_mutex_unlock(&pLog->mutex);
+	return rc;
+} /* eeLogAppend() */
+
+//
+// Write the records held in RAM now
+// (the partial page is closed; new records start the next one)
+// returns 0 for success, -1 for error
+//
+int eeLogFlush(ee_log *pLog)
+{
+int rc;
+
+	pthread_mutex_lock(&pLog->mutex);
+	rc = eeLogWritePage(pLog);
+	pthread_mutex_unlock(&pLog->mutex);
+	return rc;
+} /* eeLogFlush() */
+
+//
+// Pass the records of one page to the callback
+// returns the callback's non-zero result or 0 to continue
+//
+static int eeLogReplay(ee_log *pLog, unsigned char *pPage, int iUsed, ee_log_cb pfnCallback, void *pUser)
+{
+int i, iLen, rc;
+uint32_t ulBase;
+
+	ulBase = eeLogGet32(&pPage[4]);
+	i = LOG_HDR;
+	iUsed += LOG_HDR;
+	while (i < iUsed)
+	{
+		iLen = (pLog->iRecLen) ? pLog->iRecLen : pPage[i++];
+		if (i + 2 + iLen > iUsed) // can't happen in an intact page
+			break;
+		rc = (*pfnCallback)((time_t)(ulBase + (pPage[i] | (pPage[i+1] << 8))), &pPage[i+2], iLen, pUser);
+		if (rc)
+			return rc;
+		i += 2 + iLen;
+	}
+	return 0;
+} /* eeLogReplay() */
+
+//
+// Stream every record from the oldest to the newest (including the
+// ones not written yet) to a callback; it returns non-zero to stop
+// Pages are read several at a time; damaged pages are skipped
+// returns 0 for success, -1 for error
+//
+int eeLogRead(ee_log *pLog, ee_log_cb pfnCallback, void *pUser)
+{
+unsigned char *pBuf;
+int i, iPage, iLeft, iCount, rc = 0;
+
+	pBuf = (unsigned char *)malloc(LOG_READ_PAGES * pLog->iPageSize);
+	if (pBuf == NULL)
+		return -1;
+	pthread_mutex_lock(&pLog->mutex);
+	iPage = (pLog->bWrapped) ? pLog->iHead : 0;
+	iLeft = (pLog->bWrapped) ? pLog->iPages : pLog->iHead;
+	while (iLeft > 0 && rc == 0)
+	{
+		iCount = pLog->iPages - iPage; // one read can't wrap around
+		if (iCount > iLeft) iCount = iLeft;
+		if (iCount > LOG_READ_PAGES) iCount = LOG_READ_PAGES;
+		if (eeDevRead(pLog->pEE, pLog->iStart + (iPage * pLog->iPageSize), pBuf, iCount * pLog->iPageSize) != iCount * pLog->iPageSize)
+		{
+			rc = -1;
+			break;
+		}
+		for (i=0; i<iCount && rc == 0; i++)
+		{
+			if (eeLogValid(pLog, &pBuf[i * pLog->iPageSize]))
+				rc = eeLogReplay(pLog, &pBuf[i * pLog->iPageSize], pBuf[(i * pLog->iPageSize) + 8], pfnCallback, pUser);
+		}
+		iLeft -= iCount;
+		iPage += iCount;
+		if (iPage == pLog->iPages)
+			iPage = 0;
+	}
+	if (rc == 0 && pLog->iUsed)
+	{
+		eeLogPut32(&pLog->ucPage[4], pLog->ulBase);
+		rc = eeLogReplay(pLog, pLog->ucPage, pLog->iUsed, pfnCallback, pUser);
+	}
+	pthread_mutex_unlock(&pLog->mutex);
+	free(pBuf);
+	return (rc < 0) ? -1 : 0;
+} /* eeLogRead() */
@@ -0,0 +1,174 @@
+//
+// DS3231 and xxx
+// Real Time Clock + EEPROM library
+// Multi-chip EEPROM volumes
+//
+// Joins several EEPROMs (e.g. AT24Cxx parts strapped to 0x50-0x57) into
+// one linear address space, either one after the other or striped a
+// page at a time across the chips. eeDevWrite() doesn't wait for the
+// write cycle it starts, so when the pages are striped, the next page
+// goes to another chip while the previous ones are still programming
+// and N chips take close to N times the sustained write rate.
+//
+// Written by Larry Bank
+// Copyright (c) 2018 BitBank Software, Inc.
+// bitbank@pobox.com
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rtc.h"
+#include "rtc_priv.h"
+
+#define EE_VOL_MAX 8 // one per address strap
+
+struct ee_vol {
+	ee_dev *pDevs[EE_VOL_MAX];
+	int iCount;
+	int bStripe;
+	int iPageSize; // stripe size
+	int iSize; // total bytes
+};
+
+//
+// Find the chip and its address for a volume address
+// returns the number of bytes which are contiguous there
+//
+static int eeVolMap(ee_vol *pVol, int iAddr, int *pDev, int *pDevAddr)
+{
+int i, iPage;
+
+	if (pVol->bStripe)
+	{
+		iPage = iAddr / pVol->iPageSize;
+		*pDev = iPage % pVol->iCount;
+		*pDevAddr = ((iPage / pVol->iCount) * pVol->iPageSize) + (iAddr % pVol->iPageSize);
+		return pVol->iPageSize - (iAddr % pVol->iPageSize);
+	}
+	for (i=0; iAddr >= pVol->pDevs[i]->iSize; i++)
+		iAddr -= pVol->pDevs[i]->iSize;
+	*pDev = i;
+	*pDevAddr = iAddr;
+	return pVol->pDevs[i]->iSize - iAddr;
+} /* eeVolMap() */
+
+//
+// Create a volume from iCount open EEPROMs (the volume doesn't take
+// ownership of them). bStripe = 0 places them one after another;
+// otherwise consecutive pages rotate across the chips, which must
+// then have the same page size (the smallest size is used for all)
+// returns NULL for failure
+//
+ee_vol *eeVolOpen(ee_dev **pDevs, int iCount, int bStripe)
+{
+ee_vol *pVol;
+int i, iMin;
+
+	if (iCount < 1 || iCount > EE_VOL_MAX)
+		return NULL;
+	iMin = pDevs[0]->iSize;
+	for (i=1; i<iCount; i++)
+	{
+		if (bStripe && pDevs[i]->iPageSize != pDevs[0]->iPageSize)
+			return NULL;
+		if (pDevs[i]->iSize < iMin)
+			iMin = pDevs[i]->iSize;
+	}
+	pVol = (ee_vol *)calloc(1, sizeof(ee_vol));
+	if (pVol == NULL)
+		return NULL;
+	memcpy(pVol->pDevs, pDevs, iCount * sizeof(ee_dev *));
+	pVol->iCount = iCount;
+	pVol->bStripe = bStripe;
+	pVol->iPageSize = pDevs[0]->iPageSize;
+	if (bStripe)
+	{
+		pVol->iSize = (iMin - (iMin % pVol->iPageSize)) * iCount;
+	}
+	else
+	{
+		for (i=0; i<iCount; i++)
+			pVol->iSize += pDevs[i]->iSize;
+	}
+	return pVol;
+} /* eeVolOpen() */
+
+//
+// Free a volume (the EEPROMs stay open)
+//
+void eeVolClose(ee_vol *pVol)
+{
+	free(pVol);
+} /* eeVolClose() */
+
+//
+// Total size of the volume in bytes
+//
+int eeVolSize(ee_vol *pVol)
+{
+	return pVol->iSize;
+} /* eeVolSize() */
+
+//
+// Read any number of bytes from the volume
+// returns the number of bytes read or -1 for error
+//
+int eeVolRead(ee_vol *pVol, int iAddr, unsigned char *pData, int iLen)
+{
+int iDev, iDevAddr, iCount, iTotal = 0;
+
+	if (iAddr < 0 || iLen < 0 || iAddr + iLen > pVol->iSize)
+		return -1;
+	while (iTotal < iLen)
+	{
+		iCount = eeVolMap(pVol, iAddr, &iDev, &iDevAddr);
+		if (iCount > iLen - iTotal)
+			iCount = iLen - iTotal;
+		if (eeDevRead(pVol->pDevs[iDev], iDevAddr, &pData[iTotal], iCount) != iCount)
+			return -1;
+		iTotal += iCount;
+		iAddr += iCount;
+	}
+	return iTotal;
+} /* eeVolRead() */
+
+//
+// Write any number of bytes to the volume
+// The last write cycle of each chip is left running
+// returns the number of bytes written or -1 for error
+//
+int eeVolWrite(ee_vol *pVol, int iAddr, unsigned char *pData, int iLen)
+{
+int iDev, iDevAddr, iCount, iTotal = 0;
+
+	if (iAddr < 0 || iLen < 0 || iAddr + iLen > pVol->iSize)
+		return -1;
+	while (iTotal < iLen)
+	{
+		iCount = eeVolMap(pVol, iAddr, &iDev, &iDevAddr);
+		if (iCount > iLen - iTotal)
+			iCount = iLen - iTotal;
+		if (eeDevWrite(pVol->pDevs[iDev], iDevAddr, &pData[iTotal], iCount) != iCount)
+			return (iTotal > 0) ? iTotal : -1;
+		iTotal += iCount;
+		iAddr += iCount;
+	}
+	return iTotal;
+} /* eeVolWrite() */
+
+//
+// Wait for the write cycles of every chip to complete
+// returns 0 for success, -1 for timeout
+//
+int eeVolWaitReady(ee_vol *pVol)
+{
+int i, rc = 0;
+
+	for (i=0; i<pVol->iCount; i++)
+	{
+		if (eeDevWaitReady(pVol->pDevs[i], 0) != 0)
+			rc = -1;
+	}
+	return rc;
+} /* eeVolWaitReady() */
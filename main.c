@@ -24,6 +24,7 @@ int main(int argc, char *argv[])
 int i;
 struct tm *thetime;
 time_t tt;
+int64_t llResidual;
 
 	if (argc != 2)
 	{
@@ -48,8 +49,11 @@ time_t tt;
 	}
 	else if (strcmp(argv[1], "set") == 0) // set RTC to system time
 	{
-		rtcSetTime(thetime); // set the current time
-		printf("DS3231 time set to system time\n");
+		// set it on the next seconds edge of the system clock
+		if (rtcDevSetTimePrecise(rtcGetHandle(), 1, &llResidual) == 0)
+			printf("DS3231 time set to system time (%+lld us)\n", (long long)(llResidual / 1000));
+		else
+			printf("Error setting the DS3231 time\n");
 	}
 	else
 	{
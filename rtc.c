@@ -9,264 +9,1299 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include "rtc.h"
+#include "rtc_priv.h"
+
+#define EE_POLL_CYCLES 4 // give up ACK polling after this many write cycle times
+#define I2C_MAX_READ 8192 // largest single message the i2c-dev driver allows
+#define MAX_BUSES 16 // number of I2C buses which can be open at once
+
+// The legacy functions operate on a default instance of each device
+static rtc_dev *pDefRTC = NULL;
+static ee_dev *pDefEE = NULL;
+
+static i2c_bus busPool[MAX_BUSES];
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
 
-static int rtc_i2c = -1;
-static int ee_i2c = -1;
 //
-// Opens a file system handle to the EEPROM I2C device
+// Get a reference to the shared handle of an I2C bus
+// opening it if this is the first user
+// A non-NULL pfnTransfer creates the bus with that backend instead of
+// /dev/i2c-N (bNew = 1 fails if the channel is already in use)
 //
-int eeInit(int iChannel, int iAddr)
+static i2c_bus *i2cBusAttach(int iChannel, rtc_xfer_fn pfnTransfer, void *pCtx, int bNew)
 {
+pthread_mutexattr_t attr;
 char filename[32];
- 
-	sprintf(filename, "/dev/i2c-%d", iChannel);
-	if ((ee_i2c = open(filename, O_RDWR)) < 0)
+i2c_bus *pBus = NULL;
+int i;
+
+	pthread_mutex_lock(&poolMutex);
+	for (i=0; i<MAX_BUSES; i++)
 	{
-		fprintf(stderr, "Failed to open the i2c bus; need to run as root?\n");
-		return -1;
+		if (busPool[i].iRefCount > 0 && busPool[i].iChannel == iChannel)
+		{
+			if (!bNew)
+			{
+				pBus = &busPool[i];
+				pBus->iRefCount++;
+			}
+			goto done;
+		}
+	}
+	for (i=0; i<MAX_BUSES; i++) // find a free slot
+	{
+		if (busPool[i].iRefCount == 0)
+			break;
 	}
+	if (i == MAX_BUSES) // pool is full
+		goto done;
+	if (pfnTransfer == NULL) // a real bus
+	{
+		sprintf(filename, "/dev/i2c-%d", iChannel);
+		busPool[i].fd = open(filename, O_RDWR);
+		if (busPool[i].fd < 0)
+		{
+			fprintf(stderr, "Failed to open the i2c bus; need to run as root?\n");
+			goto done;
+		}
+	}
+	else
+	{
+		busPool[i].fd = -1;
+	}
+	pBus = &busPool[i];
+	pBus->iChannel = iChannel;
+	pBus->iRefCount = 1;
+	pBus->pfnTransfer = pfnTransfer;
+	pBus->pCtx = pCtx;
+	memset(&pBus->stats, 0, sizeof(pBus->stats));
+	memset(pBus->devStats, 0, sizeof(pBus->devStats));
+	pBus->pfnTrace = NULL;
+	// recursive, so a locked sequence can call functions which also lock
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&pBus->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+done:
+	pthread_mutex_unlock(&poolMutex);
+	return pBus;
+} /* i2cBusAttach() */
+
+i2c_bus *i2cBusOpen(int iChannel)
+{
+	return i2cBusAttach(iChannel, NULL, NULL, 0);
+} /* i2cBusOpen() */
 
-	if (ioctl(ee_i2c, I2C_SLAVE, iAddr) < 0)
+//
+// Release a reference to a bus; the last user closes it
+//
+void i2cBusClose(i2c_bus *pBus)
+{
+	pthread_mutex_lock(&poolMutex);
+	if (--pBus->iRefCount == 0)
 	{
-		close(ee_i2c);
-		fprintf(stderr, "Failed to acquire bus access or talk to slave\n");
-		ee_i2c = -1;
+		if (pBus->fd >= 0)
+			close(pBus->fd);
+		pthread_mutex_destroy(&pBus->mutex);
+	}
+	pthread_mutex_unlock(&poolMutex);
+} /* i2cBusClose() */
+
+//
+// Serve an I2C channel with a custom transfer function instead of
+// /dev/i2c-N (e.g. the simulator in rtc_sim.c)
+// Devices opened on iChannel afterwards use it. The function gets the
+// messages of one transaction and returns 0 if all of them were ACK'd
+// or -1 if any was NAK'd
+// returns 0 for success, -1 if the channel is already open
+//
+int rtcBusRegister(int iChannel, rtc_xfer_fn pfnTransfer, void *pCtx)
+{
+	if (pfnTransfer == NULL)
 		return -1;
+	return (i2cBusAttach(iChannel, pfnTransfer, pCtx, 1) == NULL) ? -1 : 0;
+} /* rtcBusRegister() */
+
+//
+// Remove a backend installed by rtcBusRegister
+// (close the devices using it first)
+//
+void rtcBusUnregister(int iChannel)
+{
+i2c_bus *pBus = NULL;
+int i;
+
+	pthread_mutex_lock(&poolMutex);
+	for (i=0; i<MAX_BUSES; i++)
+	{
+		if (busPool[i].iRefCount > 0 && busPool[i].iChannel == iChannel && busPool[i].pfnTransfer)
+			pBus = &busPool[i];
+	}
+	pthread_mutex_unlock(&poolMutex);
+	if (pBus)
+		i2cBusClose(pBus); // drop the reference taken by rtcBusRegister
+} /* rtcBusUnregister() */
+
+//
+// Hold the bus across several transactions
+// (e.g. a read-modify-write of a register)
+//
+void i2cBusLock(i2c_bus *pBus)
+{
+	pthread_mutex_lock(&pBus->mutex);
+} /* i2cBusLock() */
+
+void i2cBusUnlock(i2c_bus *pBus)
+{
+	pthread_mutex_unlock(&pBus->mutex);
+} /* i2cBusUnlock() */
+
+//
+// Send a group of messages as a single transaction
+// The messages are separated by repeated starts, so nothing else
+// can get on the bus between them, and it only costs one syscall
+// returns 0 for success, -1 for error
+//
+int i2cTransfer(i2c_bus *pBus, struct i2c_msg *pMsgs, int iCount)
+{
+struct i2c_rdwr_ioctl_data data;
+struct timespec ts;
+rtc_dev_stats *pStats;
+int64_t llStart, llTime;
+int i, iBytes = 0, rc;
+
+	i2cBusLock(pBus);
+	clock_gettime(CLOCK_MONOTONIC, &ts); // (a vDSO call, not a syscall)
+	llStart = (ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+	if (pBus->pfnTransfer)
+	{
+		rc = (*pBus->pfnTransfer)(pBus->pCtx, pMsgs, iCount);
+	}
+	else
+	{
+		data.msgs = pMsgs;
+		data.nmsgs = iCount;
+		rc = (ioctl(pBus->fd, I2C_RDWR, &data) == iCount) ? 0 : -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	llTime = (ts.tv_sec * 1000000000LL) + ts.tv_nsec - llStart;
+	for (i=0; i<iCount; i++)
+		iBytes += pMsgs[i].len;
+	pBus->stats.ullTransfers++;
+	pBus->stats.ullMessages += iCount;
+	pBus->stats.ullBytes += iBytes;
+	pStats = &pBus->devStats[pMsgs[0].addr & 0x7f];
+	pStats->ullTransfers++;
+	pStats->ullBytes += iBytes;
+	pStats->ullBusNs += llTime;
+	if ((uint64_t)llTime > pStats->ullMaxNs)
+		pStats->ullMaxNs = llTime;
+	if (rc != 0)
+	{
+		pBus->stats.ullErrors++;
+		pStats->ullNaks++;
 	}
+	if (pBus->pfnTrace)
+		(*pBus->pfnTrace)(pBus->pTraceUser, pBus->iChannel, pMsgs, iCount, rc, llTime);
+	i2cBusUnlock(pBus);
+	return rc;
+} /* i2cTransfer() */
+
+//
+// Find an open bus by channel number and lock it
+// returns NULL if no device has it open
+//
+static i2c_bus *i2cBusFind(int iChannel)
+{
+i2c_bus *pBus = NULL;
+int i;
+
+	pthread_mutex_lock(&poolMutex);
+	for (i=0; i<MAX_BUSES; i++)
+	{
+		if (busPool[i].iRefCount > 0 && busPool[i].iChannel == iChannel)
+		{
+			pBus = &busPool[i];
+			i2cBusLock(pBus);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&poolMutex);
+	return pBus;
+} /* i2cBusFind() */
+
+//
+// Get the traffic counters of a bus
+// returns 0 for success, -1 if the bus isn't open
+//
+int rtcBusGetStats(int iChannel, rtc_bus_stats *pStats)
+{
+i2c_bus *pBus;
+
+	pBus = i2cBusFind(iChannel);
+	if (pBus == NULL)
+		return -1;
+	*pStats = pBus->stats;
+	i2cBusUnlock(pBus);
 	return 0;
-} /* eeInit() */
+} /* rtcBusGetStats() */
 
-int eeReadByte(int iAddr, unsigned char *pData)
+void rtcBusResetStats(int iChannel)
+{
+i2c_bus *pBus;
+
+	pBus = i2cBusFind(iChannel);
+	if (pBus == NULL)
+		return;
+	memset(&pBus->stats, 0, sizeof(pBus->stats));
+	memset(pBus->devStats, 0, sizeof(pBus->devStats));
+	i2cBusUnlock(pBus);
+} /* rtcBusResetStats() */
+
+//
+// Install a function which is called after every transfer on a bus
+// (NULL removes it; the only cost without one is a pointer test)
+// returns 0 for success, -1 if the bus isn't open
+//
+int rtcBusSetTrace(int iChannel, rtc_trace_fn pfnTrace, void *pUser)
+{
+i2c_bus *pBus;
+
+	pBus = i2cBusFind(iChannel);
+	if (pBus == NULL)
+		return -1;
+	pBus->pfnTrace = pfnTrace;
+	pBus->pTraceUser = pUser;
+	i2cBusUnlock(pBus);
+	return 0;
+} /* rtcBusSetTrace() */
+
+//
+// Count a repeated attempt of a transfer to a device
+//
+void i2cCountRetry(i2c_bus *pBus, int iAddr)
+{
+	i2cBusLock(pBus);
+	pBus->devStats[iAddr & 0x7f].ullRetries++;
+	i2cBusUnlock(pBus);
+} /* i2cCountRetry() */
+
+//
+// Copy or clear the counters of one device
+//
+static void i2cDevStats(i2c_bus *pBus, int iAddr, rtc_dev_stats *pStats)
+{
+	i2cBusLock(pBus);
+	if (pStats)
+		*pStats = pBus->devStats[iAddr & 0x7f];
+	else
+		memset(&pBus->devStats[iAddr & 0x7f], 0, sizeof(rtc_dev_stats));
+	i2cBusUnlock(pBus);
+} /* i2cDevStats() */
+
+void rtcDevGetStats(rtc_dev *pRTC, rtc_dev_stats *pStats)
+{
+	i2cDevStats(pRTC->pBus, pRTC->iAddr, pStats);
+} /* rtcDevGetStats() */
+
+void rtcDevResetStats(rtc_dev *pRTC)
+{
+	i2cDevStats(pRTC->pBus, pRTC->iAddr, NULL);
+} /* rtcDevResetStats() */
+
+void eeDevGetStats(ee_dev *pEE, rtc_dev_stats *pStats)
+{
+	i2cDevStats(pEE->pBus, pEE->iAddr, pStats);
+} /* eeDevGetStats() */
+
+void eeDevResetStats(ee_dev *pEE)
+{
+	i2cDevStats(pEE->pBus, pEE->iAddr, NULL);
+} /* eeDevResetStats() */
+
+//
+// Write a block of data to a device
+//
+int i2cWriteData(i2c_bus *pBus, int iAddr, unsigned char *pData, int iLen)
+{
+struct i2c_msg msg;
+
+	msg.addr = iAddr;
+	msg.flags = 0;
+	msg.len = iLen;
+	msg.buf = pData;
+	return i2cTransfer(pBus, &msg, 1);
+} /* i2cWriteData() */
+
+//
+// Read a block of data from a device's current address
+//
+int i2cReadData(i2c_bus *pBus, int iAddr, unsigned char *pData, int iLen)
+{
+struct i2c_msg msg;
+
+	msg.addr = iAddr;
+	msg.flags = I2C_M_RD;
+	msg.len = iLen;
+	msg.buf = pData;
+	return i2cTransfer(pBus, &msg, 1);
+} /* i2cReadData() */
+
+//
+// Set the register pointer and read from it with a repeated start
+//
+int i2cReadReg(i2c_bus *pBus, int iAddr, unsigned char ucReg, unsigned char *pData, int iLen)
+{
+struct i2c_msg msgs[2];
+
+	msgs[0].addr = iAddr;
+	msgs[0].flags = 0;
+	msgs[0].len = 1;
+	msgs[0].buf = &ucReg;
+	msgs[1].addr = iAddr;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = iLen;
+	msgs[1].buf = pData;
+	return i2cTransfer(pBus, msgs, 2);
+} /* i2cReadReg() */
+//
+// Opens a file system handle to the EEPROM I2C device
+// returns a new device context or NULL for failure
+//
+ee_dev *eeOpen(int iChannel, int iAddr)
+{
+ee_dev *pEE;
+ 
+	pEE = (ee_dev *)calloc(1, sizeof(ee_dev));
+	if (pEE == NULL)
+		return NULL;
+	pEE->pBus = i2cBusOpen(iChannel);
+	if (pEE->pBus == NULL)
+	{
+		free(pEE);
+		return NULL;
+	}
+	pEE->iAddr = iAddr;
+	pEE->iSize = 4096; // AT24C32
+	pEE->iPageSize = EE_PAGE_SIZE;
+	pEE->iAddrBytes = 2;
+	pEE->iWriteUs = 5000;
+	return pEE;
+} /* eeOpen() */
+
+//
+// CRC-32 of a block of data; pass 0 to start or the previous result
+// to continue. A 16 entry table (a nibble at a time) keeps it small.
+//
+uint32_t eeCrc32(uint32_t ulCrc, const unsigned char *pData, int iLen)
+{
+static const uint32_t ulTable[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+	ulCrc = ~ulCrc;
+	while (iLen-- > 0)
+	{
+		ulCrc ^= *pData++;
+		ulCrc = (ulCrc >> 4) ^ ulTable[ulCrc & 15];
+		ulCrc = (ulCrc >> 4) ^ ulTable[ulCrc & 15];
+	}
+	return ~ulCrc;
+} /* eeCrc32() */
+
+//
+// Closes an EEPROM device context
+//
+void eeClose(ee_dev *pEE)
+{
+	if (pEE == NULL)
+		return;
+	i2cBusClose(pEE->pBus);
+	free(pEE);
+} /* eeClose() */
+
+//
+// Send a transaction to the EEPROM, retrying while it NAKs
+// During an internal write cycle the EEPROM does not acknowledge
+// its address, so the first successful transfer marks the end of the cycle
+// returns 0 for success, -1 if it timed out
+//
+static int eeTransferPolled(ee_dev *pEE, struct i2c_msg *pMsgs, int iCount)
+{
+struct timespec ts;
+long long llStart, llNow;
+
+	if (i2cTransfer(pEE->pBus, pMsgs, iCount) == 0) // not busy (the common case)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	llStart = (ts.tv_sec * 1000000LL) + (ts.tv_nsec / 1000);
+	do {
+		i2cCountRetry(pEE->pBus, pEE->iAddr);
+		if (i2cTransfer(pEE->pBus, pMsgs, iCount) == 0)
+			return 0;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		llNow = (ts.tv_sec * 1000000LL) + (ts.tv_nsec / 1000);
+	} while (llNow - llStart < (long long)pEE->iWriteUs * EE_POLL_CYCLES);
+	return -1;
+} /* eeTransferPolled() */
+
+//
+// Store a memory address at the start of a message and choose the
+// slave address; parts with 1 address byte take bits 8-10 of the
+// memory address in the low bits of the slave address
+// returns the number of address bytes
+//
+static int eeSetAddr(ee_dev *pEE, int iAddr, unsigned char *pTemp, int *pSlave)
+{
+	if (pEE->iAddrBytes == 1)
+	{
+		*pSlave = pEE->iAddr | ((iAddr >> 8) & 7);
+		pTemp[0] = (unsigned char)iAddr;
+		return 1;
+	}
+	*pSlave = pEE->iAddr;
+	pTemp[0] = (unsigned char)(iAddr >> 8);
+	pTemp[1] = (unsigned char)iAddr;
+	return 2;
+} /* eeSetAddr() */
+
+//
+// Write a message to the EEPROM, waiting out a pending write cycle
+//
+static int eeWritePolled(ee_dev *pEE, int iSlave, unsigned char *pData, int iLen)
+{
+struct i2c_msg msg;
+
+	msg.addr = iSlave;
+	msg.flags = 0;
+	msg.len = iLen;
+	msg.buf = pData;
+	return eeTransferPolled(pEE, &msg, 1);
+} /* eeWritePolled() */
+
+//
+// Set the EEPROM address and read from it with a repeated start
+//
+static int eeReadPolled(ee_dev *pEE, int iAddr, unsigned char *pData, int iLen)
+{
+struct i2c_msg msgs[2];
+unsigned char ucTemp[2];
+int iSlave;
+
+	msgs[0].len = eeSetAddr(pEE, iAddr, ucTemp, &iSlave);
+	msgs[0].addr = iSlave;
+	msgs[0].flags = 0;
+	msgs[0].buf = ucTemp;
+	msgs[1].addr = iSlave;
+	msgs[1].flags = I2C_M_RD;
+	msgs[1].len = iLen;
+	msgs[1].buf = pData;
+	return eeTransferPolled(pEE, msgs, 2);
+} /* eeReadPolled() */
+
+//
+// Wait for a pending write cycle to complete
+// Polls by re-sending the given address, so the next sequential read
+// or write continues from there
+// returns 0 for success, -1 for timeout
+//
+int eeDevWaitReady(ee_dev *pEE, int iAddr)
 {
 unsigned char ucTemp[4];
+int iSlave, iCount;
+
+	iCount = eeSetAddr(pEE, iAddr, ucTemp, &iSlave);
+	return eeWritePolled(pEE, iSlave, ucTemp, iCount);
+} /* eeDevWaitReady() */
+
+int eeDevReadByte(ee_dev *pEE, int iAddr, unsigned char *pData)
+{
 int rc;
 
 	if (iAddr != -1) // send the address
-	{
-		ucTemp[0] = (unsigned char)(iAddr >> 8);
-		ucTemp[1] = (unsigned char)iAddr;
-		rc = write(ee_i2c, ucTemp, 2);
-		usleep(10000);
-	} // otherwise read from the last address and increment
-	rc = read(ee_i2c, pData, 1);
-	return (rc == 1);
-} /* eeReadByte() */
+		rc = eeReadPolled(pEE, iAddr, pData, 1); // waits out a pending write
+	else // otherwise read from the last address and increment
+		rc = i2cReadData(pEE->pBus, pEE->iAddr, pData, 1);
+	return (rc == 0);
+} /* eeDevReadByte() */
 
 //
 // Read a block of 32 bytes at the given address
 // or from the last read address if iAddr == -1
 //
-int eeReadBlock(int iAddr, unsigned char *pData)
+int eeDevReadBlock(ee_dev *pEE, int iAddr, unsigned char *pData)
 {
-unsigned char ucTemp[4];
 int rc;
 
 	if (iAddr != -1) // send the address
-	{
-		ucTemp[0] = (unsigned char)(iAddr >> 8);
-		ucTemp[1] = (unsigned char)iAddr;
-		rc = write(ee_i2c, ucTemp, 2);
-	} // otherwise read from the last address and increment
-	rc = read(ee_i2c, pData, 32);
-	return (rc == 32);
-} /* eeReadBlock() */
+		rc = (eeDevRead(pEE, iAddr, pData, 32) == 32) ? 0 : -1;
+	else // otherwise read from the last address and increment
+		rc = i2cReadData(pEE->pBus, pEE->iAddr, pData, 32);
+	return (rc == 0);
+} /* eeDevReadBlock() */
 
-int eeWriteByte(int iAddr, unsigned char ucByte)
+int eeDevWriteByte(ee_dev *pEE, int iAddr, unsigned char ucByte)
 {
 unsigned char ucTemp[4];
-int rc;
+int rc, iSlave, iCount;
 
 	if (iAddr != -1) // send the address
 	{
-		ucTemp[0] = (unsigned char)(iAddr >> 8);
-		ucTemp[1] = (unsigned char)iAddr;
-		ucTemp[2] = ucByte;
+		iCount = eeSetAddr(pEE, iAddr, ucTemp, &iSlave);
+		ucTemp[iCount] = ucByte;
 		// The first data byte must be written with
 		// the address atomically or it won't work
-		rc = write(ee_i2c, ucTemp, 3);
-		return (rc == 3);
+		rc = eeWritePolled(pEE, iSlave, ucTemp, iCount+1);
 	} // otherwise write from the last address and increment
 	else
 	{
-		rc = write(ee_i2c, &ucByte, 1);
-		return (rc == 1);
+		rc = i2cWriteData(pEE->pBus, pEE->iAddr, &ucByte, 1);
 	}
-} /* eeWriteByte() */
+	return (rc == 0);
+} /* eeDevWriteByte() */
 
-int eeWriteBlock(int iAddr, unsigned char *pData)
+int eeDevWriteBlock(ee_dev *pEE, int iAddr, unsigned char *pData)
 {
-unsigned char ucTemp[34];
 int rc;
 
-	if (iAddr != -1) // send the address
+	if (iAddr != -1) // send the address (split if the pages are smaller)
 	{
-		ucTemp[0] = (unsigned char)(iAddr >> 8);
-		ucTemp[1] = (unsigned char)iAddr;
-		memcpy(&ucTemp[2], pData, 32);
-		rc = write(ee_i2c, ucTemp, 34);
-		return (rc == 34);
+		rc = (eeDevWrite(pEE, iAddr, pData, 32) == 32) ? 0 : -1;
 	} // otherwise write to the last address and increment
 	else
 	{
-		rc = write(ee_i2c, pData, 32);
-		return (rc == 32);
+		rc = i2cWriteData(pEE->pBus, pEE->iAddr, pData, 32);
 	}
-} /* eeWriteBlock() */
+	return (rc == 0);
+} /* eeDevWriteBlock() */
 
 //
-// Closes all file system handles
+// Read any number of bytes starting at the given address
+// The address is set once and the data is streamed with sequential reads
+// in the same transaction (one message per 8K the driver accepts); parts
+// with 1 address byte need a transaction per 256 byte block
+// returns the number of bytes read or -1 for error
 //
-void rtcShutdown(void)
+int eeDevRead(ee_dev *pEE, int iAddr, unsigned char *pData, int iLen)
 {
-	if (rtc_i2c >= 0) close(rtc_i2c);
-	if (ee_i2c >= 0) close(ee_i2c);
-} /* rtcShutdown() */
+struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+unsigned char ucTemp[2];
+int i, iSlave, iCount, iEnd, iTotal = 0;
+
+	while (iTotal < iLen)
+	{
+		iEnd = iLen;
+		if (pEE->iAddrBytes == 1 && iEnd - iTotal > 256 - (iAddr & 0xff))
+			iEnd = iTotal + 256 - (iAddr & 0xff);
+		msgs[0].len = eeSetAddr(pEE, iAddr, ucTemp, &iSlave);
+		msgs[0].addr = iSlave;
+		msgs[0].flags = 0;
+		msgs[0].buf = ucTemp;
+		for (i=1; i<I2C_RDWR_IOCTL_MAX_MSGS && iTotal < iEnd; i++)
+		{
+			iCount = iEnd - iTotal;
+			if (iCount > I2C_MAX_READ)
+				iCount = I2C_MAX_READ;
+			msgs[i].addr = iSlave;
+			msgs[i].flags = I2C_M_RD;
+			msgs[i].len = iCount;
+			msgs[i].buf = &pData[iTotal];
+			iTotal += iCount;
+			iAddr += iCount;
+		}
+		if (eeTransferPolled(pEE, msgs, i) != 0)
+			return -1;
+	}
+	return iTotal;
+} /* eeDevRead() */
+
 //
-// Opens a file system handle to the RTC I2C device
+// Write any number of bytes starting at the given address
+// The data is split on page boundaries because a single write which
+// crosses a page wraps around to the start of the same page
+// Each page is sent as soon as the previous write cycle completes; the
+// last one is left running and the next access polls for it
+// returns the number of bytes written or -1 for error
 //
-int rtcInit(int iChannel, int iAddr)
+int eeDevWrite(ee_dev *pEE, int iAddr, unsigned char *pData, int iLen)
 {
-char filename[32];
-unsigned char ucTemp[2];
- 
-	sprintf(filename, "/dev/i2c-%d", iChannel);
-	if ((rtc_i2c = open(filename, O_RDWR)) < 0)
+unsigned char ucTemp[EE_MAX_PAGE+2];
+int rc, iSlave, iHeader, iCount, iTotal = 0;
+
+	while (iTotal < iLen)
+	{
+		// write up to the end of the current page
+		iCount = pEE->iPageSize - (iAddr & (pEE->iPageSize-1));
+		if (iCount > iLen - iTotal)
+			iCount = iLen - iTotal;
+		iHeader = eeSetAddr(pEE, iAddr, ucTemp, &iSlave);
+		memcpy(&ucTemp[iHeader], &pData[iTotal], iCount);
+		rc = eeWritePolled(pEE, iSlave, ucTemp, iCount+iHeader);
+		if (rc != 0)
+			return (iTotal > 0) ? iTotal : -1;
+		iTotal += iCount;
+		iAddr += iCount;
+	}
+	return iTotal;
+} /* eeDevWrite() */
+
+//
+// Part of a request which falls in its i'th page
+// returns the length and sets the offset in the data
+//
+static int eeVerifyPage(ee_dev *pEE, int iAddr, int iLen, int i, int *pOffset)
+{
+int iStart, iEnd;
+
+	iStart = (i * pEE->iPageSize) - (iAddr & (pEE->iPageSize - 1));
+	iEnd = iStart + pEE->iPageSize;
+	if (iStart < 0)
+		iStart = 0;
+	if (iEnd > iLen)
+		iEnd = iLen;
+	*pOffset = iStart;
+	return iEnd - iStart;
+} /* eeVerifyPage() */
+
+//
+// Write any number of bytes and make sure they landed
+// The whole range is read back in one sequential read and the CRC-32 of
+// each page is compared with that of the data; only the pages which
+// differ are written again (up to iRetries times) and read back
+// returns the number of bytes written or -1 for error
+//
+int eeDevWriteVerify(ee_dev *pEE, int iAddr, unsigned char *pData, int iLen, int iRetries)
+{
+unsigned char *pRead;
+uint32_t *pCrc;
+int i, iPages, iOffset, iEnd, iCount, iFirst, iLast, iBadFirst, iBadLast, rc = 0;
+
+	if (iLen <= 0)
+		return 0;
+	iPages = ((iAddr & (pEE->iPageSize - 1)) + iLen + pEE->iPageSize - 1) / pEE->iPageSize;
+	pRead = (unsigned char *)malloc(iLen);
+	pCrc = (uint32_t *)malloc(iPages * sizeof(uint32_t));
+	if (pRead == NULL || pCrc == NULL)
 	{
-		fprintf(stderr, "Failed to open the i2c bus; need to run as root?\n");
+		free(pRead);
+		free(pCrc);
 		return -1;
 	}
+	for (i=0; i<iPages; i++)
+	{
+		iCount = eeVerifyPage(pEE, iAddr, iLen, i, &iOffset);
+		pCrc[i] = eeCrc32(0, &pData[iOffset], iCount);
+	}
+	if (eeDevWrite(pEE, iAddr, pData, iLen) != iLen)
+		rc = -1;
+	iFirst = 0;
+	iLast = iPages - 1;
+	while (rc == 0 && iFirst <= iLast)
+	{
+		// read back the pages from iFirst to iLast in one go
+		eeVerifyPage(pEE, iAddr, iLen, iFirst, &iOffset);
+		iEnd = eeVerifyPage(pEE, iAddr, iLen, iLast, &iCount);
+		iEnd += iCount;
+		if (eeDevRead(pEE, iAddr + iOffset, &pRead[iOffset], iEnd - iOffset) != iEnd - iOffset)
+		{
+			rc = -1;
+			break;
+		}
+		iBadFirst = iPages;
+		iBadLast = -1;
+		for (i=iFirst; i<=iLast; i++)
+		{
+			iCount = eeVerifyPage(pEE, iAddr, iLen, i, &iOffset);
+			if (eeCrc32(0, &pRead[iOffset], iCount) == pCrc[i])
+				continue;
+			if (iRetries <= 0 || eeDevWrite(pEE, iAddr + iOffset, &pData[iOffset], iCount) != iCount)
+			{
+				rc = -1;
+				break;
+			}
+			if (i < iBadFirst)
+				iBadFirst = i;
+			iBadLast = i;
+		}
+		iRetries--;
+		iFirst = iBadFirst;
+		iLast = iBadLast;
+	}
+	free(pRead);
+	free(pCrc);
+	return (rc == 0) ? iLen : -1;
+} /* eeDevWriteVerify() */
 
-	if (ioctl(rtc_i2c, I2C_SLAVE, iAddr) < 0)
+//
+// Describe the EEPROM which is really fitted
+// returns 0 for success, -1 if the geometry isn't possible
+//
+int eeDevSetGeometry(ee_dev *pEE, const ee_geometry *pGeom)
+{
+	if (pGeom->iPageSize < 1 || pGeom->iPageSize > EE_MAX_PAGE ||
+		(pGeom->iPageSize & (pGeom->iPageSize - 1)) || pGeom->iSize < pGeom->iPageSize ||
+		(pGeom->iSize % pGeom->iPageSize) || pGeom->iWriteUs <= 0)
+		return -1;
+	if (pGeom->iAddrBytes == 1)
+	{
+		// the block number replaces the low bits of the slave address
+		if (pGeom->iSize > 2048 || (pEE->iAddr & ((pGeom->iSize - 1) >> 8)))
+			return -1;
+	}
+	else if (pGeom->iAddrBytes != 2 || pGeom->iSize > 65536)
 	{
-		close(rtc_i2c);
-		fprintf(stderr, "Failed to acquire bus access or talk to slave\n");
-		rtc_i2c = -1;
 		return -1;
 	}
-	ucTemp[0] = 0x11; // 8 MSBs of temperature
-	write(rtc_i2c, ucTemp, 1);
-	ucTemp[1] = 0;
-	read(rtc_i2c, &ucTemp[1], 1);
-	if (ucTemp[1] == 0) { // error reading; device is not connected
-            return -1;
-	}
-	ucTemp[0] = 0xe; // control register
-	write(rtc_i2c, ucTemp, 1);
-	read(rtc_i2c, &ucTemp[1], 1); // read contents
-	ucTemp[1] &= ~64; // turn off square wave on battery
-	ucTemp[1] &= ~4; // enable time on battery
-	write(rtc_i2c, ucTemp, 2); // write it back
-//	ucTemp[0] = 0xf; // control register
-//	ucTemp[1] = 0; // turn on oscillator and turn off alarms
-//	write(rtc_i2c, ucTemp, 2);
+	pEE->iSize = pGeom->iSize;
+	pEE->iPageSize = pGeom->iPageSize;
+	pEE->iAddrBytes = pGeom->iAddrBytes;
+	pEE->iWriteUs = pGeom->iWriteUs;
 	return 0;
+} /* eeDevSetGeometry() */
 
-} /* rtcInit() */
+void eeDevGetGeometry(ee_dev *pEE, ee_geometry *pGeom)
+{
+	pGeom->iSize = pEE->iSize;
+	pGeom->iPageSize = pEE->iPageSize;
+	pGeom->iAddrBytes = pEE->iAddrBytes;
+	pGeom->iWriteUs = pEE->iWriteUs;
+} /* eeDevGetGeometry() */
 
 //
-// Read the current internal temperature
-// Value is celcius * 4 (resolution of 0.25C)
+// Does address iSize wrap around to address 0?
+// The chip ignores the address bits above its capacity, so if it has
+// iSize bytes, changing byte 0 changes byte iSize too (byte 0 is put back)
+// returns 1 if it does, 0 if not, -1 for error
 //
-int rtcGetTemp(void)
+static int eeProbeWrap(ee_dev *pEE, int iSize)
 {
-unsigned char ucTemp[2];
-int rc, iTemp = 0;
+unsigned char ucOld, ucHigh, ucTest;
+int rc;
+
+	if (eeDevRead(pEE, 0, &ucOld, 1) != 1 || eeDevRead(pEE, iSize, &ucHigh, 1) != 1)
+		return -1;
+	if (ucHigh != ucOld) // different data, so different bytes
+		return 0;
+	ucTest = ucOld ^ 0xff;
+	if (eeDevWrite(pEE, 0, &ucTest, 1) != 1 || eeDevRead(pEE, iSize, &ucHigh, 1) != 1)
+		return -1;
+	rc = (ucHigh == ucTest);
+	if (eeDevWrite(pEE, 0, &ucOld, 1) != 1)
+		return -1;
+	return rc;
+} /* eeProbeWrap() */
 
-	ucTemp[0] = 0x11; // MSB location
-	write(rtc_i2c, ucTemp, 1);
-	rc = read(rtc_i2c, ucTemp, 2);
-	if (rc == 2)
+//
+// Find the capacity of a 24Cxx part with 1 or 2 address bytes and set
+// its geometry to that of the standard part of that size (the write
+// time isn't changed). Byte 0 may be rewritten with its own value.
+// For 1 address byte parts the slave addresses after this one count
+// as more blocks of the same chip, so don't put other chips there.
+// returns the capacity in bytes or -1 for error
+//
+int eeDevProbe(ee_dev *pEE, int iAddrBytes)
+{
+static const ee_geometry geom1[] = {EE_GEOM_24C01, EE_GEOM_24C02, EE_GEOM_24C04, EE_GEOM_24C08, EE_GEOM_24C16};
+static const ee_geometry geom2[] = {EE_GEOM_24C32, EE_GEOM_24C64, EE_GEOM_24C128, EE_GEOM_24C256, EE_GEOM_24C512};
+ee_geometry old, geom;
+const ee_geometry *pList;
+unsigned char ucTemp;
+int i, rc = 0;
+
+	eeDevGetGeometry(pEE, &old);
+	if (iAddrBytes == 1)
 	{
-		iTemp = ucTemp[0] << 8; // high byte
-		iTemp |= ucTemp[1]; // low byte
-		iTemp >>= 6; // lower 2 bits are fraction; upper 8 bits = integer part
+		geom = (ee_geometry)EE_GEOM_24C02;
+		pList = geom1;
 	}
-	return iTemp;
-} /* rtcGetTemp() */
+	else
+	{
+		geom = (ee_geometry)EE_GEOM_24C512;
+		pList = geom2;
+	}
+	geom.iWriteUs = old.iWriteUs;
+	if (eeDevSetGeometry(pEE, &geom) != 0)
+		return -1;
+	if (iAddrBytes == 1)
+	{
+		rc = eeProbeWrap(pEE, 128);
+		i = 0; // 24C01
+		if (rc == 0) // 256 bytes or more; see how many block addresses answer
+		{
+			rc = eeDevWaitReady(pEE, 0);
+			for (i=1; i<4 && rc == 0 && !(pEE->iAddr & (1 << (i-1))) &&
+				i2cReadData(pEE->pBus, pEE->iAddr + (1 << (i-1)), &ucTemp, 1) == 0; i++) {};
+		}
+	}
+	else
+	{
+		for (i=0; i<4; i++)
+		{
+			rc = eeProbeWrap(pEE, pList[i].iSize);
+			if (rc != 0)
+				break;
+		}
+	}
+	if (rc < 0)
+	{
+		eeDevSetGeometry(pEE, &old);
+		return -1;
+	}
+	geom = pList[i];
+	geom.iWriteUs = old.iWriteUs;
+	eeDevSetGeometry(pEE, &geom);
+	return pEE->iSize;
+} /* eeDevProbe() */
 
 //
-// Set the current time/date
+// Closes an RTC device context
 //
-int rtcSetTime(struct tm *pTime)
+void rtcClose(rtc_dev *pRTC)
+{
+	if (pRTC == NULL)
+		return;
+	rtcClockFree(pRTC);
+	rtcAlarmClose(pRTC);
+	i2cBusClose(pRTC->pBus);
+	free(pRTC);
+} /* rtcClose() */
+//
+// Chip drivers indexed by type
+//
+static const rtc_chip *pChips[RTC_TYPE_COUNT] = {
+	NULL, // RTC_UNKNOWN
+	&rtcChipPCF8563,
+	&rtcChipDS3231,
+	&rtcChipRV3032
+};
+
+//
+// Opens a file system handle to the RTC I2C device
+// iType selects the chip driver (RTC_DS3231, RTC_PCF8563 or RTC_RV3032)
+// returns a new device context or NULL for failure
+//
+rtc_dev *rtcOpenChip(int iChannel, int iAddr, int iType)
+{
+rtc_dev *pRTC;
+
+	if (iType <= RTC_UNKNOWN || iType >= RTC_TYPE_COUNT)
+		return NULL;
+	pRTC = (rtc_dev *)calloc(1, sizeof(rtc_dev));
+	if (pRTC == NULL)
+		return NULL;
+	pRTC->pBus = i2cBusOpen(iChannel);
+	if (pRTC->pBus == NULL)
+	{
+		free(pRTC);
+		return NULL;
+	}
+	pRTC->iAddr = iAddr;
+	pRTC->pChip = pChips[iType];
+	pRTC->iAlarmFd = -1;
+	rtcClockInit(pRTC);
+	if ((*pRTC->pChip->pfnInit)(pRTC) != 0) // device is not connected
+	{
+		rtcClose(pRTC);
+		return NULL;
+	}
+	return pRTC;
+} /* rtcOpenChip() */
+
+//
+// Opens a DS3231
+// returns a new device context or NULL for failure
+//
+rtc_dev *rtcOpen(int iChannel, int iAddr)
+{
+	return rtcOpenChip(iChannel, iAddr, RTC_DS3231);
+} /* rtcOpen() */
+
+//
+// The chip type the device was opened with
+//
+int rtcDevGetType(rtc_dev *pRTC)
+{
+	return pRTC->pChip->iType;
+} /* rtcDevGetType() */
+
+//
+// Read iLen registers starting at iReg
+// (always from the chip; the shadow copy is refreshed with them)
+// returns 0 for success, -1 for error
+//
+int rtcDevReadReg(rtc_dev *pRTC, int iReg, unsigned char *pData, int iLen)
+{
+int rc;
+
+	i2cBusLock(pRTC->pBus);
+	rc = i2cReadReg(pRTC->pBus, pRTC->iAddr, (unsigned char)iReg, pData, iLen);
+	if (rc == 0 && iReg + iLen <= 256)
+		memcpy(&pRTC->ucShadow[iReg], pData, iLen);
+	i2cBusUnlock(pRTC->pBus);
+	return rc;
+} /* rtcDevReadReg() */
+
+//
+// Write iLen (up to 32) registers starting at iReg
+// The shadow copy follows; writing any of the time registers
+// invalidates the cached clock
+// returns 0 for success, -1 for error
+//
+int rtcDevWriteReg(rtc_dev *pRTC, int iReg, const unsigned char *pData, int iLen)
+{
+unsigned char ucTemp[33];
+int rc;
+
+	if (iLen < 1 || iLen > 32)
+		return -1;
+	ucTemp[0] = (unsigned char)iReg;
+	memcpy(&ucTemp[1], pData, iLen);
+	i2cBusLock(pRTC->pBus);
+	rc = i2cWriteData(pRTC->pBus, pRTC->iAddr, ucTemp, iLen + 1);
+	if (rc == 0 && iReg + iLen <= 256)
+		memcpy(&pRTC->ucShadow[iReg], pData, iLen);
+	else
+		pRTC->bShadowValid = 0;
+	i2cBusUnlock(pRTC->pBus);
+	if (iReg < pRTC->pChip->ucTimeReg + 7 && iReg + iLen > pRTC->pChip->ucTimeReg)
+		rtcClockInvalidate(pRTC);
+	return rc;
+} /* rtcDevWriteReg() */
+
+//
+// Fill the shadow copy with one burst read of each of the chip's windows
+// returns 0 for success, -1 for error
+//
+int rtcShadowLoad(rtc_dev *pRTC)
+{
+const rtc_chip *pChip = pRTC->pChip;
+int i, rc = 0;
+
+	i2cBusLock(pRTC->pBus);
+	for (i=0; i<2 && pChip->ucShadow[i][1] != 0 && rc == 0; i++)
+		rc = i2cReadReg(pRTC->pBus, pRTC->iAddr, pChip->ucShadow[i][0], &pRTC->ucShadow[pChip->ucShadow[i][0]], pChip->ucShadow[i][1]);
+	pRTC->bShadowValid = (rc == 0);
+	i2cBusUnlock(pRTC->pBus);
+	return rc;
+} /* rtcShadowLoad() */
+
+//
+// Read registers from the shadow copy (reloading it if needed)
+// returns 0 for success, -1 for error
+//
+int rtcShadowRead(rtc_dev *pRTC, int iReg, unsigned char *pData, int iLen)
+{
+int rc = 0;
+
+	i2cBusLock(pRTC->pBus);
+	if (!pRTC->bShadowValid)
+		rc = rtcShadowLoad(pRTC);
+	if (rc == 0)
+		memcpy(pData, &pRTC->ucShadow[iReg], iLen);
+	i2cBusUnlock(pRTC->pBus);
+	return rc;
+} /* rtcShadowRead() */
+
+//
+// Write registers through the shadow copy
+// Nothing is sent if they already hold these values
+// returns 0 for success, -1 for error
+//
+int rtcShadowWrite(rtc_dev *pRTC, int iReg, const unsigned char *pData, int iLen)
+{
+unsigned char ucTemp[33];
+int rc = 0;
+
+	if (iLen < 1 || iLen > 32 || iReg + iLen > 256)
+		return -1;
+	i2cBusLock(pRTC->pBus);
+	if (!pRTC->bShadowValid || memcmp(&pRTC->ucShadow[iReg], pData, iLen) != 0)
+	{
+		ucTemp[0] = (unsigned char)iReg;
+		memcpy(&ucTemp[1], pData, iLen);
+		rc = i2cWriteData(pRTC->pBus, pRTC->iAddr, ucTemp, iLen + 1);
+		if (rc == 0)
+			memcpy(&pRTC->ucShadow[iReg], pData, iLen);
+		else // the chip may or may not have taken it
+			pRTC->bShadowValid = 0;
+	}
+	i2cBusUnlock(pRTC->pBus);
+	return rc;
+} /* rtcShadowWrite() */
+
+//
+// Change some bits of one register in a single write (or none)
+// returns 0 for success, -1 for error
+//
+int rtcShadowUpdate(rtc_dev *pRTC, int iReg, unsigned char ucClear, unsigned char ucSet)
+{
+unsigned char uc;
+int rc;
+
+	i2cBusLock(pRTC->pBus);
+	rc = rtcShadowRead(pRTC, iReg, &uc, 1);
+	if (rc == 0)
+	{
+		uc = (uc & ~ucClear) | ucSet;
+		rc = rtcShadowWrite(pRTC, iReg, &uc, 1);
+	}
+	i2cBusUnlock(pRTC->pBus);
+	return rc;
+} /* rtcShadowUpdate() */
+
+//
+// Read the current internal temperature
+// Value is celcius * 4 (resolution of 0.25C); 0 if the chip has no sensor
+//
+int rtcDevGetTemp(rtc_dev *pRTC)
+{
+	return (*pRTC->pChip->pfnGetTemp)(pRTC);
+} /* rtcDevGetTemp() */
+
+//
+// Build the register frame which sets the time
+// (register pointer + 7 time registers in the DS3231 layout)
+//
+static void rtcEncodeTime(struct tm *pTime, unsigned char *ucTemp)
 {
-unsigned char ucTemp[20];
 int i;
+
 	ucTemp[0] = 0; // start at register 0
-	// seconds
-	ucTemp[1] = ((pTime->tm_sec / 10) << 4);
-	ucTemp[1] |= (pTime->tm_sec % 10);
-	// minutes
-	ucTemp[2] = ((pTime->tm_min / 10) << 4);
-	ucTemp[2] |= (pTime->tm_min % 10);
-	// hours (and set 24-hour format)
-	ucTemp[3] = ((pTime->tm_hour / 10) << 4);
-	ucTemp[3] |= (pTime->tm_hour % 10);
-	// day of the week
-	ucTemp[4] = pTime->tm_wday + 1;
-	// day of the month
-	ucTemp[5] = (pTime->tm_mday / 10) << 4;
-	ucTemp[5] |= (pTime->tm_mday % 10);
+	ucTemp[1] = BIN2BCD(pTime->tm_sec);
+	ucTemp[2] = BIN2BCD(pTime->tm_min);
+	ucTemp[3] = BIN2BCD(pTime->tm_hour); // (and set 24-hour format)
+	ucTemp[4] = pTime->tm_wday + 1; // day of the week
+	ucTemp[5] = BIN2BCD(pTime->tm_mday);
 	// month + century
 	i = pTime->tm_mon+1; // 1-12 on the RTC
-	ucTemp[6] = (i / 10) << 4;
-	ucTemp[6] |= (i % 10);
-	if (pTime->tm_year >= 100)
-		ucTemp[6] |= 0x80; // century bit
-	// year
-	ucTemp[7] = (((pTime->tm_year % 100)/10) << 4);
-	ucTemp[7] |= (pTime->tm_year % 10);
-
-	write(rtc_i2c, ucTemp, 8);
+	ucTemp[6] = BIN2BCD(i) | ((pTime->tm_year >= 100) << 7);
+	ucTemp[7] = BIN2BCD(pTime->tm_year % 100);
+} /* rtcEncodeTime() */
+
+//
+// Days since 1970-01-01 of a date in the proleptic Gregorian calendar
+// (years >= 0; counted from March so leap days fall at the end)
+//
+static int64_t rtcDaysFromCivil(int iYear, int iMonth, int iDay)
+{
+int iEra, iYOE, iDOY, iDOE;
+
+	iYear -= (iMonth <= 2);
+	iEra = iYear / 400;
+	iYOE = iYear - (iEra * 400); // 0-399
+	iDOY = ((153 * (iMonth + ((iMonth > 2) ? -3 : 9))) + 2) / 5 + iDay - 1;
+	iDOE = (iYOE * 365) + (iYOE / 4) - (iYOE / 100) + iDOY;
+	return ((int64_t)iEra * 146097) + iDOE - 719468;
+} /* rtcDaysFromCivil() */
+
+//
+// Convert the 7 time registers to seconds since 1970
+// The fields are taken as-is (no time zone is applied)
+//
+int64_t rtcDecodeEpoch(unsigned char *ucTemp)
+{
+int iHour, iYear;
+
+	if (ucTemp[2] & 64) // 12 hour format
+		iHour = BCD2BIN(ucTemp[2] & 0x1f) % 12 + ((ucTemp[2] >> 5) & 1) * 12;
+	else
+		iHour = BCD2BIN(ucTemp[2] & 0x3f);
+	iYear = 1900 + ((ucTemp[5] >> 7) * 100) + BCD2BIN(ucTemp[6]); // century bit = 20xx
+	return (rtcDaysFromCivil(iYear, BCD2BIN(ucTemp[5] & 0x1f), BCD2BIN(ucTemp[4])) * 86400) +
+		(iHour * 3600) + (BCD2BIN(ucTemp[1]) * 60) + BCD2BIN(ucTemp[0]);
+} /* rtcDecodeEpoch() */
+
+//
+// Build the register frame for a time in seconds since 1970
+// (the inverse of rtcDaysFromCivil)
+//
+void rtcEncodeEpoch(int64_t llTime, unsigned char *ucTemp)
+{
+int iDays, iSecs, iEra, iDOE, iYOE, iDOY, iMP, iYear, iMonth, iDay;
+
+	iDays = (int)(llTime / 86400);
+	iSecs = (int)(llTime - ((int64_t)iDays * 86400));
+	ucTemp[0] = 0; // start at register 0
+	ucTemp[1] = BIN2BCD(iSecs % 60);
+	ucTemp[2] = BIN2BCD((iSecs / 60) % 60);
+	ucTemp[3] = BIN2BCD(iSecs / 3600);
+	ucTemp[4] = ((iDays + 4) % 7) + 1; // 1970-01-01 was a Thursday
+	iDays += 719468; // shift the epoch to 0000-03-01
+	iEra = iDays / 146097;
+	iDOE = iDays - (iEra * 146097);
+	iYOE = (iDOE - (iDOE / 1460) + (iDOE / 36524) - (iDOE / 146096)) / 365;
+	iDOY = iDOE - ((365 * iYOE) + (iYOE / 4) - (iYOE / 100));
+	iMP = ((5 * iDOY) + 2) / 153;
+	iDay = iDOY - (((153 * iMP) + 2) / 5) + 1;
+	iMonth = iMP + ((iMP < 10) ? 3 : -9);
+	iYear = iYOE + (iEra * 400) + (iMonth <= 2) - 1900;
+	ucTemp[5] = BIN2BCD(iDay);
+	ucTemp[6] = BIN2BCD(iMonth) | ((iYear >= 100) << 7); // century bit
+	ucTemp[7] = BIN2BCD(iYear % 100);
+} /* rtcEncodeEpoch() */
+
+//
+// Set the current time/date
+//
+int rtcDevSetTime(rtc_dev *pRTC, struct tm *pTime)
+{
+unsigned char ucTemp[20];
+int i;
+
+	rtcEncodeTime(pTime, ucTemp);
+	(*pRTC->pChip->pfnEncode)(ucTemp);
+	i = i2cWriteData(pRTC->pBus, pRTC->iAddr, ucTemp, 8);
+	rtcClockInvalidate(pRTC); // the cached clock no longer matches
+	return i;
+} /* rtcDevSetTime() */
+
+static int64_t rtcRealNs(void)
+{
+struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+} /* rtcRealNs() */
+
+//
+// Set the RTC to the system time, aligned to the system's seconds edge
+// Writing the seconds register restarts the chip's countdown chain
+// (on the ACK of the seconds byte), so the frame for the next second is
+// built in advance and sent just as the system clock reaches it.
+// bLocalTime selects local time (as the sample app uses) or UTC.
+// The estimated offset of the restart from the true edge is returned
+// in pResidual (ns, positive = late)
+// returns 0 for success, -1 for error
+//
+int rtcDevSetTimePrecise(rtc_dev *pRTC, int bLocalTime, int64_t *pResidual)
+{
+unsigned char ucTemp[20];
+int64_t llBefore, llAfter, llLatency, llEdge, llTarget;
+struct timespec ts;
+struct tm tm;
+time_t tt;
+int rc;
+
+	// Time a transaction of the same size to learn the bus + syscall cost
+	llBefore = rtcRealNs();
+	if (i2cReadReg(pRTC->pBus, pRTC->iAddr, pRTC->pChip->ucTimeReg, ucTemp, 7) != 0)
+		return -1;
+	llLatency = rtcRealNs() - llBefore;
+	// the seconds byte is the 3rd of 9 on the wire
+	llLatency /= 3;
+
+	// Pick an edge far enough away to prepare for it
+	llEdge = ((rtcRealNs() / 1000000000LL) + 1) * 1000000000LL;
+	if (llEdge - rtcRealNs() < 20000000LL) // less than 20ms left
+		llEdge += 1000000000LL;
+	tt = (time_t)(llEdge / 1000000000LL);
+	if (bLocalTime)
+	{
+		localtime_r(&tt, &tm);
+		rtcEncodeTime(&tm, ucTemp);
+	}
+	else
+	{
+		rtcEncodeEpoch(tt, ucTemp);
+	}
+	(*pRTC->pChip->pfnEncode)(ucTemp);
+
+	// Sleep most of the way there, then spin for the rest
+	llTarget = llEdge - llLatency;
+	ts.tv_sec = (llTarget - 2000000LL) / 1000000000LL;
+	ts.tv_nsec = (llTarget - 2000000LL) % 1000000000LL;
+	clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &ts, NULL);
+	i2cBusLock(pRTC->pBus); // don't let another device take the bus now
+	while ((llBefore = rtcRealNs()) < llTarget) {}
+	rc = i2cWriteData(pRTC->pBus, pRTC->iAddr, ucTemp, 8);
+	llAfter = rtcRealNs();
+	i2cBusUnlock(pRTC->pBus);
+	rtcClockInvalidate(pRTC);
+	if (rc != 0)
+		return -1;
+	if (pResidual)
+		*pResidual = llBefore + ((llAfter - llBefore) / 3) - llEdge;
 	return 0;
-} /* rtcSetTime() */
+} /* rtcDevSetTimePrecise() */
 
 //
 // Read the current time/date
 //
-int rtcGetTime(struct tm *pTime)
+int rtcDevGetTime(rtc_dev *pRTC, struct tm *pTime)
 {
 unsigned char ucTemp[20];
-int i,rc;
 
-	ucTemp[0] = 0; // start of data registers we want
-	rc = write(rtc_i2c, ucTemp, 1); // write address of register to read
-	i = read(rtc_i2c, ucTemp, 7);
-	if (rc < 0 || i != 7)
+	// start of data registers we want
+	if (i2cReadReg(pRTC->pBus, pRTC->iAddr, pRTC->pChip->ucTimeReg, ucTemp, 7) != 0)
 	{
 		return -1; // something went wrong
 	}
+	(*pRTC->pChip->pfnDecode)(ucTemp);
 	memset(pTime, 0, sizeof(struct tm));
 	// convert numbers from BCD
-	pTime->tm_sec = ((ucTemp[0] >> 4) * 10) + (ucTemp[0] & 0xf);
-	pTime->tm_min = ((ucTemp[1] >> 4) * 10) + (ucTemp[1] & 0xf);
+	pTime->tm_sec = BCD2BIN(ucTemp[0]);
+	pTime->tm_min = BCD2BIN(ucTemp[1]);
 	// hours are stored in 24-hour format in the tm struct
 	if (ucTemp[2] & 64) // 12 hour format
 	{
-		pTime->tm_hour = ucTemp[2] & 0xf;
-		pTime->tm_hour += ((ucTemp[2] >> 4) & 1) * 10;
+		pTime->tm_hour = BCD2BIN(ucTemp[2] & 0x1f) % 12;
 		pTime->tm_hour += ((ucTemp[2] >> 5) & 1) * 12; // AM/PM
 	}
 	else // 24 hour format
 	{
-		pTime->tm_hour = ((ucTemp[2] >> 4) * 10) + (ucTemp[2] & 0xf);	
+		pTime->tm_hour = BCD2BIN(ucTemp[2] & 0x3f);
 	}
 	pTime->tm_wday = ucTemp[3] - 1; // day of the week (0-6)
-	// day of the month
-	pTime->tm_mday = ((ucTemp[4] >> 4) * 10) + (ucTemp[4] & 0xf);
-	// month
-	pTime->tm_mon = (((ucTemp[5] >> 4) & 1) * 10 + (ucTemp[5] & 0xf)) -1; // 0-11
-	pTime->tm_year = (ucTemp[5] >> 7) * 100; // century
-	pTime->tm_year += ((ucTemp[6] >> 4) * 10) + (ucTemp[6] & 0xf);
+	pTime->tm_mday = BCD2BIN(ucTemp[4]); // day of the month
+	pTime->tm_mon = BCD2BIN(ucTemp[5] & 0x1f) - 1; // 0-11
+	pTime->tm_year = ((ucTemp[5] >> 7) * 100) + BCD2BIN(ucTemp[6]); // century + year
 
 	return 0;
 
-} /* rtcGetTime() */
+} /* rtcDevGetTime() */
+
+//
+// Read the current time as seconds since 1970
+// Converts straight from the registers without mktime() or time zones,
+// so it's the RTC's own time scale (UTC if it was set with rtcDevSetEpoch)
+// returns -1 for error
+//
+int64_t rtcDevGetEpoch(rtc_dev *pRTC)
+{
+unsigned char ucTemp[8];
+
+	if (i2cReadReg(pRTC->pBus, pRTC->iAddr, pRTC->pChip->ucTimeReg, ucTemp, 7) != 0)
+		return -1;
+	(*pRTC->pChip->pfnDecode)(ucTemp);
+	return rtcDecodeEpoch(ucTemp);
+} /* rtcDevGetEpoch() */
+
+//
+// Set the time from seconds since 1970 (up to the end of 2099)
+// returns 0 for success, -1 for error
+//
+int rtcDevSetEpoch(rtc_dev *pRTC, int64_t llTime)
+{
+unsigned char ucTemp[8];
+int rc;
+
+	if (llTime < 0 || llTime >= 4102444800LL) // outside 1970-2099
+		return -1;
+	rtcEncodeEpoch(llTime, ucTemp);
+	(*pRTC->pChip->pfnEncode)(ucTemp);
+	rc = i2cWriteData(pRTC->pBus, pRTC->iAddr, ucTemp, 8);
+	rtcClockInvalidate(pRTC);
+	return rc;
+} /* rtcDevSetEpoch() */
 //
 // Set Alarm for:
 // ALARM_SECOND = Once every second
@@ -274,83 +1309,170 @@ int i,rc;
 // ALARM_TIME = When a specific hour:second match
 // ALARM_DAY = When a specific day of the week and time match
 // ALARM_DATE = When a specific day of the month and time match
+// (see the chip drivers for what each one supports)
+// returns 0 for success, -1 for error
 //
-void rtcSetAlarm(uint8_t type, struct tm *pTime)
+int rtcDevSetAlarm(rtc_dev *pRTC, uint8_t type, struct tm *pTime)
 {
-unsigned char ucTemp[8];
-
-  switch (type)
-  {
-    case ALARM_SECOND: // turn on repeating alarm for every second
-      ucTemp[0] = 0xe; // control register
-      ucTemp[1] = 0x1d; // enable alarm1 interrupt
-      write(rtc_i2c, ucTemp, 2);
-      ucTemp[0] = 0x7; // starting register for alarm 1
-      ucTemp[1] = 0x80; // set bit 7 in the 4 registers to tell it a repeating alarm
-      ucTemp[2] = 0x80;
-      ucTemp[3] = 0x80;
-      ucTemp[4] = 0x80;
-      write(rtc_i2c, ucTemp, 5);
-      break;
-    case ALARM_MINUTE: // turn on repeating alarm for every minute
-      ucTemp[0] = 0xe; // control register
-      ucTemp[1] = 0x1e; // enable alarm2 interrupt
-      write(rtc_i2c, ucTemp, 2);
-      ucTemp[0] = 0xb; // starting register for alarm 2
-      ucTemp[1] = 0x80; // set bit 7 in the 3 registers to tell it a repeating alarm
-      ucTemp[2] = 0x80;
-      ucTemp[3] = 0x80;
-      write(rtc_i2c, ucTemp, 4);
-      break;
-    case ALARM_TIME: // turn on alarm to match a specific time
-    case ALARM_DAY: // turn on alarm for a specific day of the week
-    case ALARM_DATE: // turn on alarm for a specific date
-      ucTemp[0] = 0xe; // control register
-      ucTemp[1] = 0x1d; // enable alarm1 interrupt
-      write(rtc_i2c, ucTemp, 2);
-// Values are stored as BCD
-      ucTemp[0] = 0x7; // start at register 7
-      // seconds
-      ucTemp[1] = ((pTime->tm_sec / 10) << 4);
-      ucTemp[1] |= (pTime->tm_sec % 10);
-      // minutes
-      ucTemp[2] = ((pTime->tm_min / 10) << 4);
-      ucTemp[2] |= (pTime->tm_min % 10);
-      // hours (and set 24-hour format)
-      ucTemp[3] = ((pTime->tm_hour / 10) << 4);
-      ucTemp[3] |= (pTime->tm_hour % 10);
-      // day of the week
-      ucTemp[4] = pTime->tm_wday + 1;
-      // day of the month
-      ucTemp[5] = (pTime->tm_mday / 10) << 4;
-      ucTemp[5] |= (pTime->tm_mday % 10);
-      // set the A1Mx bits (high bits of the 4 registers)
-      // for the specific type of alarm
-      if (type == ALARM_TIME) // A1Mx bits should be x1100
-      {
-        ucTemp[1] |= 0x80;
-        ucTemp[2] |= 0x80;
-      }
-      else if (type == ALARM_DAY) // A1Mx bits should be 10000
-      {
-        ucTemp[4] |= 0x40; // DY/DT bit
-      }
-      // for matching the date, all bits are left as 0's (00000)
-      write(rtc_i2c, ucTemp, 6);
-      break;
-  } // switch on type
-} /* rtcSetAlarm() */
+	return (*pRTC->pChip->pfnSetAlarm)(pRTC, type, pTime);
+} /* rtcDevSetAlarm() */
 
 //
 // Reset the "fired" bits for Alarm 1 and 2
 // Interrupts will not occur until these bits are cleared
+// returns 0 for success, -1 for error
 //
-void rtcClearAlarms(void)
+int rtcDevClearAlarms(rtc_dev *pRTC)
 {
-unsigned char ucTemp[2];
+	return (*pRTC->pChip->pfnClearAlarms)(pRTC);
+} /* rtcDevClearAlarms() */
+
+//
+// Turn off the interrupts of the alarms in iAlarms (RTC_ALARM1 and/or
+// RTC_ALARM2); their settings are kept for the next rtcDevSetAlarm()
+// returns 0 for success, -1 for error
+//
+int rtcDevDisableAlarms(rtc_dev *pRTC, int iAlarms)
+{
+	return (*pRTC->pChip->pfnDisableAlarms)(pRTC, iAlarms);
+} /* rtcDevDisableAlarms() */
+
+//
+// Read the time, alarms, status and temperature in one transaction
+// returns 0 for success, -1 for error
+//
+int rtcDevSnapshot(rtc_dev *pRTC, rtc_snapshot *pSnap)
+{
+	memset(pSnap, 0, sizeof(rtc_snapshot));
+	return (*pRTC->pChip->pfnSnapshot)(pRTC, pSnap);
+} /* rtcDevSnapshot() */
+
+
+//
+// Legacy API
+// These operate on a single default RTC and EEPROM
+//
+
+//
+// Opens the default EEPROM
+//
+int eeInit(int iChannel, int iAddr)
+{
+	eeClose(pDefEE);
+	pDefEE = eeOpen(iChannel, iAddr);
+	return (pDefEE != NULL) ? 0 : -1;
+} /* eeInit() */
+
+//
+// Opens the default RTC
+//
+int rtcInit(int iChannel, int iAddr)
+{
+	rtcClose(pDefRTC);
+	pDefRTC = rtcOpen(iChannel, iAddr);
+	return (pDefRTC != NULL) ? 0 : -1;
+} /* rtcInit() */
+
+//
+// Closes the default devices
+//
+void rtcShutdown(void)
+{
+	rtcClose(pDefRTC);
+	eeClose(pDefEE);
+	pDefRTC = NULL;
+	pDefEE = NULL;
+} /* rtcShutdown() */
+
+//
+// Access the default devices for use with the context API
+//
+rtc_dev *rtcGetHandle(void)
+{
+	return pDefRTC;
+} /* rtcGetHandle() */
+
+ee_dev *eeGetHandle(void)
+{
+	return pDefEE;
+} /* eeGetHandle() */
+
+int eeReadByte(int iAddr, unsigned char *pData)
+{
+	return (pDefEE) ? eeDevReadByte(pDefEE, iAddr, pData) : 0;
+} /* eeReadByte() */
+
+int eeReadBlock(int iAddr, unsigned char *pData)
+{
+	return (pDefEE) ? eeDevReadBlock(pDefEE, iAddr, pData) : 0;
+} /* eeReadBlock() */
+
+int eeWriteByte(int iAddr, unsigned char ucByte)
+{
+	return (pDefEE) ? eeDevWriteByte(pDefEE, iAddr, ucByte) : 0;
+} /* eeWriteByte() */
+
+int eeWriteBlock(int iAddr, unsigned char *pData)
+{
+	return (pDefEE) ? eeDevWriteBlock(pDefEE, iAddr, pData) : 0;
+} /* eeWriteBlock() */
+
+int eeRead(int iAddr, unsigned char *pData, int iLen)
+{
+	return (pDefEE) ? eeDevRead(pDefEE, iAddr, pData, iLen) : -1;
+} /* eeRead() */
+
+int eeWrite(int iAddr, unsigned char *pData, int iLen)
+{
+	return (pDefEE) ? eeDevWrite(pDefEE, iAddr, pData, iLen) : -1;
+} /* eeWrite() */
+
+int eeWriteVerify(int iAddr, unsigned char *pData, int iLen, int iRetries)
+{
+	return (pDefEE) ? eeDevWriteVerify(pDefEE, iAddr, pData, iLen, iRetries) : -1;
+} /* eeWriteVerify() */
+
+int eeWaitReady(int iAddr)
+{
+	return (pDefEE) ? eeDevWaitReady(pDefEE, iAddr) : -1;
+} /* eeWaitReady() */
+
+int rtcGetTime(struct tm *pTime)
+{
+	return (pDefRTC) ? rtcDevGetTime(pDefRTC, pTime) : -1;
+} /* rtcGetTime() */
+
+int rtcSetTime(struct tm *pTime)
+{
+	return (pDefRTC) ? rtcDevSetTime(pDefRTC, pTime) : -1;
+} /* rtcSetTime() */
+
+int rtcGetTemp(void)
+{
+	return (pDefRTC) ? rtcDevGetTemp(pDefRTC) : 0;
+} /* rtcGetTemp() */
+
+int rtcSetAlarm(uint8_t type, struct tm *pTime)
+{
+	return (pDefRTC) ? rtcDevSetAlarm(pDefRTC, type, pTime) : -1;
+} /* rtcSetAlarm() */
 
-  ucTemp[0] = 0xf; // control register
-  ucTemp[1] = 0x0; // clear A1F & A2F (alarm 1 or 2 fired) bit to allow it to fire again
-  write(rtc_i2c, ucTemp, 2);
+int rtcClearAlarms(void)
+{
+	return (pDefRTC) ? rtcDevClearAlarms(pDefRTC) : -1;
 } /* rtcClearAlarms() */
 
+int rtcSnapshot(rtc_snapshot *pSnap)
+{
+	return (pDefRTC) ? rtcDevSnapshot(pDefRTC, pSnap) : -1;
+} /* rtcSnapshot() */
+
+int64_t rtcGetEpoch(void)
+{
+	return (pDefRTC) ? rtcDevGetEpoch(pDefRTC) : -1;
+} /* rtcGetEpoch() */
+
+int rtcSetEpoch(int64_t llTime)
+{
+	return (pDefRTC) ? rtcDevSetEpoch(pDefRTC, llTime) : -1;
+} /* rtcSetEpoch() */
@@ -1,7 +1,13 @@
-
 #ifndef __RTC__
 #define __RTC__
 
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Alarm types
 enum {
   ALARM_SECOND=0,
@@ -11,17 +17,334 @@ enum {
   ALARM_DATE
 };
 
+// Alarm flags (bits of the status register)
+enum {
+  RTC_ALARM1=1,
+  RTC_ALARM2=2
+};
+
+// Chip types
+enum {
+  RTC_UNKNOWN=0,
+  RTC_PCF8563,
+  RTC_DS3231,
+  RTC_RV3032,
+  RTC_TYPE_COUNT
+};
+
+//
+// Device contexts
+// Each one refers to a single chip, so a process can drive
+// several RTCs and EEPROMs on any number of buses
+//
+typedef struct rtc_dev rtc_dev;
+typedef struct ee_dev ee_dev;
+
+rtc_dev *rtcOpen(int iChannel, int iAddr); // DS3231
+rtc_dev *rtcOpenChip(int iChannel, int iAddr, int iType);
+void rtcClose(rtc_dev *pRTC);
+int rtcDevGetType(rtc_dev *pRTC);
+int rtcDevReadReg(rtc_dev *pRTC, int iReg, unsigned char *pData, int iLen);
+int rtcDevWriteReg(rtc_dev *pRTC, int iReg, const unsigned char *pData, int iLen);
+int rtcDevGetTime(rtc_dev *pRTC, struct tm *pTime);
+int rtcDevSetTime(rtc_dev *pRTC, struct tm *pTime);
+int rtcDevSetTimePrecise(rtc_dev *pRTC, int bLocalTime, int64_t *pResidual);
+int64_t rtcDevGetEpoch(rtc_dev *pRTC);
+int rtcDevSetEpoch(rtc_dev *pRTC, int64_t llTime);
+int rtcDevGetTemp(rtc_dev *pRTC);
+int rtcDevSetAlarm(rtc_dev *pRTC, unsigned char type, struct tm *pTime);
+int rtcDevClearAlarms(rtc_dev *pRTC);
+int rtcDevDisableAlarms(rtc_dev *pRTC, int iAlarms); // RTC_ALARM1 | RTC_ALARM2
+
+//
+// Device discovery
+// rtcProbe() finds the supported RTCs and 24Cxx EEPROMs on a bus with
+// one transaction per candidate address (0x68 and 0x50-0x57);
+// rtcProbeBuses() probes several buses at once, one thread per bus
+//
+#define RTC_PROBE_MAX_RTC 2
+#define RTC_PROBE_MAX_EE 8
+
+typedef struct rtc_probe {
+  int iChannel;
+  int iRTCCount;
+  int iRTCType[RTC_PROBE_MAX_RTC]; // RTC_DS3231, RTC_PCF8563 or RTC_RV3032
+  int iRTCAddr[RTC_PROBE_MAX_RTC];
+  int iEECount; // slave addresses which answered (a 24C04-24C16 uses several)
+  int iEEAddr[RTC_PROBE_MAX_EE];
+} rtc_probe;
+
+int rtcProbe(int iChannel, rtc_probe *pProbe);
+int rtcProbeBuses(const int *pChannels, int iCount, rtc_probe *pProbes);
+
+//
+// Snapshot
+// Time, alarms, status and temperature from one burst read of the
+// chip's registers (0x00-0x12 on the DS3231), so they're coherent
+//
+typedef struct rtc_alarm_info {
+  int bEnabled; // its interrupt is enabled
+  int iSec, iMin, iHour; // -1 = any
+  int iDay; // date (1-31), weekday (0-6, bWeekday set) or -1 = any
+  int bWeekday;
+} rtc_alarm_info;
+
+typedef struct rtc_snapshot {
+  int64_t llTime; // seconds since 1970
+  int iHundredths; // RV-3032 only
+  int iTemp; // celcius * 4 (0 without a sensor)
+  int iAging; // DS3231 aging offset (-128 to 127)
+  int bOscStopped; // the oscillator stopped or the supply failed; the time is suspect
+  int bBusy; // DS3231 temperature conversion in progress
+  int iFired; // RTC_ALARM1/RTC_ALARM2 flags which are set
+  rtc_alarm_info alarm[2]; // DS3231 alarm 1 and 2; the alarm and the periodic interrupt on the others
+  unsigned char ucControl; // raw control and status registers
+  unsigned char ucStatus;
+} rtc_snapshot;
+
+int rtcDevSnapshot(rtc_dev *pRTC, rtc_snapshot *pSnap);
+
+//
+// Cached clock
+// rtcClockStart() samples the RTC on a seconds edge and re-syncs every
+// iResync seconds in a background thread; rtcNow() then returns the
+// RTC time in ns since 1970 from memory
+//
+int rtcClockStart(rtc_dev *pRTC, int iResync);
+void rtcClockStop(rtc_dev *pRTC);
+int rtcClockSync(rtc_dev *pRTC);
+int64_t rtcNow(rtc_dev *pRTC);
+int rtcClockGetDrift(rtc_dev *pRTC, int64_t *pDrift, int64_t *pOffset);
+
+//
+// Alarm interrupts
+// Waits on the RTC's INT pin through a GPIO line instead of
+// polling the status register
+//
+int rtcAlarmOpen(rtc_dev *pRTC, const char *szChip, int iLine);
+void rtcAlarmClose(rtc_dev *pRTC);
+int rtcAlarmWait(rtc_dev *pRTC, int iTimeoutMs);
+int rtcAlarmAck(rtc_dev *pRTC);
+
+//
+// Software timers
+// Any number of one-shot and periodic timers share Alarm 1;
+// call rtcSchedRun() each time it fires. On the PCF8563 and RV-3032
+// (no seconds alarm) they run to the minute, not the second
+//
+typedef struct rtc_sched rtc_sched;
+typedef void (*rtc_timer_cb)(int iTimer, void *pUser);
+
+rtc_sched *rtcSchedCreate(rtc_dev *pRTC);
+void rtcSchedFree(rtc_sched *pSched);
+int rtcSchedAdd(rtc_sched *pSched, time_t tWhen, int iPeriod, rtc_timer_cb pfnCallback, void *pUser);
+int rtcSchedCancel(rtc_sched *pSched, int iTimer);
+time_t rtcSchedNext(rtc_sched *pSched);
+int rtcSchedRun(rtc_sched *pSched);
+
+ee_dev *eeOpen(int iChannel, int iAddr);
+void eeClose(ee_dev *pEE);
+int eeDevReadByte(ee_dev *pEE, int iAddr, unsigned char *pData);
+int eeDevReadBlock(ee_dev *pEE, int iAddr, unsigned char *pData);
+int eeDevWriteByte(ee_dev *pEE, int iAddr, unsigned char ucByte);
+int eeDevWriteBlock(ee_dev *pEE, int iAddr, unsigned char *pData);
+int eeDevRead(ee_dev *pEE, int iAddr, unsigned char *pData, int iLen);
+int eeDevWrite(ee_dev *pEE, int iAddr, unsigned char *pData, int iLen);
+int eeDevWriteVerify(ee_dev *pEE, int iAddr, unsigned char *pData, int iLen, int iRetries);
+int eeDevWaitReady(ee_dev *pEE, int iAddr);
+
+//
+// EEPROM geometry
+// eeOpen() assumes an AT24C32; set the part which is really fitted or
+// let eeDevProbe() find the capacity of a 1 or 2 address byte part
+//
+typedef struct ee_geometry {
+	int iSize; // capacity in bytes
+	int iPageSize; // page write buffer size
+	int iAddrBytes; // 1 (24C01-24C16) or 2 (24C32-24C512)
+	int iWriteUs; // longest write cycle time (tWR)
+} ee_geometry;
+
+#define EE_GEOM_24C01  {128, 8, 1, 5000}
+#define EE_GEOM_24C02  {256, 8, 1, 5000}
+#define EE_GEOM_24C04  {512, 16, 1, 5000}
+#define EE_GEOM_24C08  {1024, 16, 1, 5000}
+#define EE_GEOM_24C16  {2048, 16, 1, 5000}
+#define EE_GEOM_24C32  {4096, 32, 2, 5000}
+#define EE_GEOM_24C64  {8192, 32, 2, 5000}
+#define EE_GEOM_24C128 {16384, 64, 2, 5000}
+#define EE_GEOM_24C256 {32768, 64, 2, 5000}
+#define EE_GEOM_24C512 {65536, 128, 2, 5000}
+
+int eeDevSetGeometry(ee_dev *pEE, const ee_geometry *pGeom);
+void eeDevGetGeometry(ee_dev *pEE, ee_geometry *pGeom);
+int eeDevProbe(ee_dev *pEE, int iAddrBytes);
+
+//
+// Bus backends
+// A channel can be served by a function instead of /dev/i2c-N; it gets
+// the messages of one transaction and returns 0 for ACK, -1 for NAK
+//
+struct i2c_msg;
+typedef int (*rtc_xfer_fn)(void *pCtx, struct i2c_msg *pMsgs, int iCount);
+
+int rtcBusRegister(int iChannel, rtc_xfer_fn pfnTransfer, void *pCtx);
+void rtcBusUnregister(int iChannel);
+
+// Traffic on a bus since it was opened or last reset
+// (on /dev/i2c-N every transfer is one ioctl)
+typedef struct rtc_bus_stats {
+  uint64_t ullTransfers; // transactions
+  uint64_t ullMessages; // messages (start or repeated start + address)
+  uint64_t ullBytes; // data bytes in both directions
+  uint64_t ullErrors; // failed transactions (NAK, timeout)
+} rtc_bus_stats;
+
+int rtcBusGetStats(int iChannel, rtc_bus_stats *pStats);
+void rtcBusResetStats(int iChannel);
+
+// Traffic to one device (counted by slave address, so two contexts
+// opened on the same chip see the same numbers)
+typedef struct rtc_dev_stats {
+  uint64_t ullTransfers; // transactions
+  uint64_t ullBytes; // data bytes in both directions
+  uint64_t ullNaks; // failed transactions (NAK or bus error)
+  uint64_t ullRetries; // repeated attempts (EEPROM ACK polling)
+  uint64_t ullBusNs; // total time spent in transfers
+  uint64_t ullMaxNs; // slowest transfer
+} rtc_dev_stats;
+
+void rtcDevGetStats(rtc_dev *pRTC, rtc_dev_stats *pStats);
+void rtcDevResetStats(rtc_dev *pRTC);
+void eeDevGetStats(ee_dev *pEE, rtc_dev_stats *pStats);
+void eeDevResetStats(ee_dev *pEE);
+
+// Called after every transfer on a bus with its messages, the result
+// (0 = ACK, -1 = failed) and its duration. It runs with the bus locked,
+// so it must not access devices on the same bus
+typedef void (*rtc_trace_fn)(void *pUser, int iChannel, struct i2c_msg *pMsgs, int iCount, int iResult, int64_t llNs);
+
+int rtcBusSetTrace(int iChannel, rtc_trace_fn pfnTrace, void *pUser);
+
+//
+// Simulated devices
+// Register-level models of the supported chips on a fake bus, for
+// testing and benchmarking without hardware. Time either follows
+// CLOCK_MONOTONIC or (bVirtual) only moves by the modelled bus time of
+// each transfer and rtcSimAdvance(), which makes runs deterministic
+//
+typedef struct rtc_sim rtc_sim;
+
+rtc_sim *rtcSimCreate(int iChannel, int iBusHz, int bVirtual);
+void rtcSimFree(rtc_sim *pSim);
+int rtcSimAddRTC(rtc_sim *pSim, int iType, int iAddr, int64_t llTime);
+int rtcSimAddEEPROM(rtc_sim *pSim, int iAddr, int iSize, int iPageSize, int iWriteUs);
+void rtcSimAdvance(rtc_sim *pSim, int64_t llNs);
+int64_t rtcSimBusTime(rtc_sim *pSim);
+
+//
+// EEPROM write-back cache
+// Keeps a copy of the whole EEPROM in RAM; writes mark the part's pages
+// (its geometry's page size) dirty and eeSync() (or the flush thread, iFlushMs after the first
+// change) programs only those pages
+//
+typedef struct ee_cache ee_cache;
+
+ee_cache *eeCacheOpen(ee_dev *pEE, int iFlushMs);
+int eeCacheClose(ee_cache *pCache);
+int eeCacheRead(ee_cache *pCache, int iAddr, unsigned char *pData, int iLen);
+int eeCacheWrite(ee_cache *pCache, int iAddr, unsigned char *pData, int iLen);
+const unsigned char *eeCacheMap(ee_cache *pCache);
+int eeSync(ee_cache *pCache);
+
+//
+// Key/value store
+// Values are appended to a circular log of EEPROM pages with a CRC,
+// spreading the wear and surviving power loss during a write
+//
+#define EE_KV_MAX_KEY 31
+#define EE_KV_MAX_VALUE 128
+
+typedef struct ee_kv ee_kv;
+
+ee_kv *eeKvMount(ee_dev *pEE, int iStart, int iLen);
+void eeKvUnmount(ee_kv *pKV);
+int eeKvGet(ee_kv *pKV, const char *szKey, unsigned char *pValue, int iMax);
+int eeKvSet(ee_kv *pKV, const char *szKey, const unsigned char *pValue, int iLen);
+int eeKvDelete(ee_kv *pKV, const char *szKey);
+
+//
+// Data logger
+// Time stamped records are packed into whole EEPROM pages written
+// around a ring, the oldest page being overwritten when it's full
+//
+typedef struct ee_log ee_log;
+typedef int (*ee_log_cb)(time_t tTime, const unsigned char *pData, int iLen, void *pUser);
+
+ee_log *eeLogOpen(ee_dev *pEE, rtc_dev *pRTC, int iStart, int iLen, int iRecLen);
+int eeLogClose(ee_log *pLog);
+int eeLogMaxRecord(ee_log *pLog);
+int eeLogAppend(ee_log *pLog, const unsigned char *pData, int iLen);
+int eeLogFlush(ee_log *pLog);
+int eeLogRead(ee_log *pLog, ee_log_cb pfnCallback, void *pUser);
+
+//
+// Asynchronous writes
+// Requests go into a lock-free queue and return at once; a worker
+// thread merges the ones on the same page and writes them
+//
+#define EE_ASYNC_MAX_WRITE 64
+
+typedef struct ee_async ee_async;
+typedef void (*ee_async_cb)(void *pUser, int iAddr, int iLen, int rc);
+
+ee_async *eeAsyncOpen(ee_dev *pEE, int iDepth);
+int eeAsyncClose(ee_async *pAsync);
+int eeAsyncWrite(ee_async *pAsync, int iAddr, const unsigned char *pData, int iLen, ee_async_cb pfnDone, void *pUser);
+int eeAsyncFlush(ee_async *pAsync);
+
+//
+// Multi-chip volumes
+// Several EEPROMs as one address space, concatenated or striped
+// a page at a time so their write cycles overlap
+//
+typedef struct ee_vol ee_vol;
+
+ee_vol *eeVolOpen(ee_dev **pDevs, int iCount, int bStripe);
+void eeVolClose(ee_vol *pVol);
+int eeVolSize(ee_vol *pVol);
+int eeVolRead(ee_vol *pVol, int iAddr, unsigned char *pData, int iLen);
+int eeVolWrite(ee_vol *pVol, int iAddr, unsigned char *pData, int iLen);
+int eeVolWaitReady(ee_vol *pVol);
+
+//
+// Legacy API
+// These functions use a default RTC and EEPROM opened by rtcInit/eeInit
+//
 int rtcInit(int iChannel, int iAddr);
 int eeInit(int iChannel, int iAddr);
 void rtcShutdown(void);
+rtc_dev *rtcGetHandle(void);
+ee_dev *eeGetHandle(void);
 int rtcGetTime(struct tm *pTime);
 int rtcSetTime(struct tm *pTime);
+int64_t rtcGetEpoch(void);
+int rtcSetEpoch(int64_t llTime);
 int rtcGetTemp(void);
 int eeReadByte(int iAddr, unsigned char *pData);
 int eeReadBlock(int iAddr, unsigned char *pData);
 int eeWriteByte(int iAddr, unsigned char ucByte);
 int eeWriteBlock(int iAddr, unsigned char *pData);
-void rtcSetAlarm(unsigned char type, struct tm *pTime);
-void rtcClearAlarms(void);
+int eeRead(int iAddr, unsigned char *pData, int iLen);
+int eeWrite(int iAddr, unsigned char *pData, int iLen);
+int eeWriteVerify(int iAddr, unsigned char *pData, int iLen, int iRetries);
+int eeWaitReady(int iAddr);
+int rtcSetAlarm(unsigned char type, struct tm *pTime);
+int rtcClearAlarms(void);
+int rtcSnapshot(rtc_snapshot *pSnap);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif // __RTC__
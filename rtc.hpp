@@ -0,0 +1,364 @@
+//
+// DS3231 and xxx
+// Real Time Clock + EEPROM library
+// C++ front-end (header only, C++14)
+//
+// Rtc<Ds3231>, Rtc<Pcf8563>, Rtc<Rv3032> and Eeprom<At24c32> (etc.)
+// take the register map, time register layout, page size and features
+// of the part from constexpr traits. The time conversion for the chip
+// is inlined into each call instead of going through the C library's
+// driver table, and a call the part can't do (the temperature of a
+// PCF8563, a weekday alarm on the RV-3032, an address past the end of
+// the EEPROM) fails to compile instead of returning an error.
+// Everything else goes to the C functions, so a handle can be shared
+// with the rest of the library (cached clock, alarms, logger...).
+//
+// Written by Larry Bank
+// Copyright (c) 2018 BitBank Software, Inc.
+// bitbank@pobox.com
+//
+#ifndef __RTC_HPP__
+#define __RTC_HPP__
+
+#include <string.h>
+#include "rtc.h"
+
+//
+// The 7 time registers in the DS3231 layout (seconds, minutes, hours,
+// weekday 1-7, date, month + century bit, year; all BCD), which the
+// chip traits convert to and from their own
+//
+struct RtcRegs {
+	unsigned char uc[7];
+};
+
+struct RtcCalendar {
+	static constexpr int bcd2bin(int x) { return x - (6 * (x >> 4)); }
+	static constexpr unsigned char bin2bcd(int x) { return (unsigned char)(x + (6 * ((x * 103) >> 10))); }
+
+	// Days since 1970-01-01 (proleptic Gregorian, years >= 0)
+	static constexpr int64_t daysFromCivil(int iYear, int iMonth, int iDay)
+	{
+		iYear -= (iMonth <= 2);
+		int iEra = iYear / 400;
+		int iYOE = iYear - (iEra * 400); // 0-399
+		int iDOY = ((153 * (iMonth + ((iMonth > 2) ? -3 : 9))) + 2) / 5 + iDay - 1;
+		int iDOE = (iYOE * 365) + (iYOE / 4) - (iYOE / 100) + iDOY;
+		return ((int64_t)iEra * 146097) + iDOE - 719468;
+	} /* daysFromCivil() */
+
+	static constexpr int64_t toEpoch(const RtcRegs &regs)
+	{
+		int iHour = (regs.uc[2] & 64) ? // 12 hour format
+			bcd2bin(regs.uc[2] & 0x1f) % 12 + ((regs.uc[2] >> 5) & 1) * 12 :
+			bcd2bin(regs.uc[2] & 0x3f);
+		int iYear = 1900 + ((regs.uc[5] >> 7) * 100) + bcd2bin(regs.uc[6]); // century bit = 20xx
+		return (daysFromCivil(iYear, bcd2bin(regs.uc[5] & 0x1f), bcd2bin(regs.uc[4])) * 86400) +
+			(iHour * 3600) + (bcd2bin(regs.uc[1]) * 60) + bcd2bin(regs.uc[0]);
+	} /* toEpoch() */
+
+	static constexpr RtcRegs fromEpoch(int64_t llTime)
+	{
+		RtcRegs regs = {};
+		int iDays = (int)(llTime / 86400);
+		int iSecs = (int)(llTime - ((int64_t)iDays * 86400));
+		regs.uc[0] = bin2bcd(iSecs % 60);
+		regs.uc[1] = bin2bcd((iSecs / 60) % 60);
+		regs.uc[2] = bin2bcd(iSecs / 3600);
+		regs.uc[3] = (unsigned char)(((iDays + 4) % 7) + 1); // 1970-01-01 was a Thursday
+		iDays += 719468; // shift the epoch to 0000-03-01
+		int iEra = iDays / 146097;
+		int iDOE = iDays - (iEra * 146097);
+		int iYOE = (iDOE - (iDOE / 1460) + (iDOE / 36524) - (iDOE / 146096)) / 365;
+		int iDOY = iDOE - ((365 * iYOE) + (iYOE / 4) - (iYOE / 100));
+		int iMP = ((5 * iDOY) + 2) / 153;
+		int iMonth = iMP + ((iMP < 10) ? 3 : -9);
+		int iYear = iYOE + (iEra * 400) + (iMonth <= 2) - 1900;
+		regs.uc[4] = bin2bcd(iDOY - (((153 * iMP) + 2) / 5) + 1);
+		regs.uc[5] = (unsigned char)(bin2bcd(iMonth) | ((iYear >= 100) << 7));
+		regs.uc[6] = bin2bcd(iYear % 100);
+		return regs;
+	} /* fromEpoch() */
+};
+
+//
+// RTC traits
+//
+struct Ds3231 {
+	static constexpr int iType = RTC_DS3231;
+	static constexpr int iAddr = 0x68;
+	static constexpr int iTimeReg = 0x00;
+	static constexpr int iAlarmReg = 0x07; // alarm 1 (alarm 2 = 0x0b)
+	static constexpr int iControlReg = 0x0e;
+	static constexpr int iStatusReg = 0x0f;
+	static constexpr int iTempReg = 0x11;
+	static constexpr int64_t llMinEpoch = 0; // 1970 (the century bit covers 1900-2099)
+	static constexpr bool bTemp = true;
+	static constexpr bool bWeekdayAlarm = true;
+	static constexpr bool bUnixCounter = false;
+
+	static constexpr RtcRegs decode(RtcRegs regs) { return regs; }
+	static constexpr RtcRegs encode(RtcRegs regs) { return regs; }
+};
+
+struct Pcf8563 {
+	static constexpr int iType = RTC_PCF8563;
+	static constexpr int iAddr = 0x51;
+	static constexpr int iTimeReg = 0x02;
+	static constexpr int iAlarmReg = 0x09;
+	static constexpr int iControlReg = 0x00;
+	static constexpr int iStatusReg = 0x01;
+	static constexpr int64_t llMinEpoch = 0;
+	static constexpr bool bTemp = false;
+	static constexpr bool bWeekdayAlarm = true;
+	static constexpr bool bUnixCounter = false;
+
+	// VL flag in the seconds; the date comes before the weekday (0-6)
+	static constexpr RtcRegs decode(RtcRegs regs)
+	{
+		unsigned char ucDate = regs.uc[3];
+		regs.uc[0] &= 0x7f;
+		regs.uc[1] &= 0x7f;
+		regs.uc[2] &= 0x3f;
+		regs.uc[3] = (unsigned char)((regs.uc[4] & 7) + 1);
+		regs.uc[4] = ucDate & 0x3f;
+		regs.uc[5] &= 0x9f;
+		return regs;
+	} /* decode() */
+	static constexpr RtcRegs encode(RtcRegs regs)
+	{
+		unsigned char ucWday = regs.uc[3];
+		regs.uc[3] = regs.uc[4];
+		regs.uc[4] = (unsigned char)(ucWday - 1);
+		return regs;
+	} /* encode() */
+};
+
+struct Rv3032 {
+	static constexpr int iType = RTC_RV3032;
+	static constexpr int iAddr = 0x51;
+	static constexpr int iTimeReg = 0x01; // after the 100ths
+	static constexpr int iAlarmReg = 0x08;
+	static constexpr int iStatusReg = 0x0d;
+	static constexpr int iTempReg = 0x0e;
+	static constexpr int iUnixReg = 0x1b;
+	static constexpr int iPmuReg = 0xc0;
+	static constexpr int64_t llMinEpoch = 946684800; // counts 2000-2099 only
+	static constexpr bool bTemp = true;
+	static constexpr bool bWeekdayAlarm = false;
+	static constexpr bool bUnixCounter = true;
+
+	// weekday 0-6, no century bit
+	static constexpr RtcRegs decode(RtcRegs regs)
+	{
+		regs.uc[0] &= 0x7f;
+		regs.uc[1] &= 0x7f;
+		regs.uc[2] &= 0x3f;
+		regs.uc[3] = (unsigned char)((regs.uc[3] & 7) + 1);
+		regs.uc[4] &= 0x3f;
+		regs.uc[5] = (regs.uc[5] & 0x1f) | 0x80;
+		return regs;
+	} /* decode() */
+	static constexpr RtcRegs encode(RtcRegs regs)
+	{
+		regs.uc[3] -= 1;
+		regs.uc[5] &= 0x1f;
+		return regs;
+	} /* encode() */
+};
+
+//
+// EEPROM traits
+//
+template <int SIZE, int PAGE, int ADDRBYTES, int WRITEUS = 5000>
+struct At24c {
+	static constexpr int iSize = SIZE;
+	static constexpr int iPageSize = PAGE;
+	static constexpr int iAddrBytes = ADDRBYTES;
+	static constexpr int iWriteUs = WRITEUS;
+};
+
+typedef At24c<128, 8, 1> At24c01;
+typedef At24c<256, 8, 1> At24c02;
+typedef At24c<512, 16, 1> At24c04;
+typedef At24c<1024, 16, 1> At24c08;
+typedef At24c<2048, 16, 1> At24c16;
+typedef At24c<4096, 32, 2> At24c32;
+typedef At24c<8192, 32, 2> At24c64;
+typedef At24c<16384, 64, 2> At24c128;
+typedef At24c<32768, 64, 2> At24c256;
+typedef At24c<65536, 128, 2> At24c512;
+
+//
+// An RTC of type CHIP
+//
+template <class CHIP>
+class Rtc {
+public:
+	Rtc() : pRTC(NULL) {}
+	~Rtc() { close(); }
+	Rtc(const Rtc &) = delete;
+	Rtc &operator=(const Rtc &) = delete;
+
+	// returns 0 for success, -1 for error
+	int open(int iChannel, int iAddr = CHIP::iAddr)
+	{
+		close();
+		pRTC = rtcOpenChip(iChannel, iAddr, CHIP::iType);
+		return (pRTC != NULL) ? 0 : -1;
+	} /* open() */
+
+	void close()
+	{
+		rtcClose(pRTC);
+		pRTC = NULL;
+	} /* close() */
+
+	rtc_dev *handle() const { return pRTC; }
+
+	// The time registers for a time in seconds since 1970, in the chip's layout
+	static constexpr RtcRegs frame(int64_t llTime) { return CHIP::encode(RtcCalendar::fromEpoch(llTime)); }
+
+	int64_t getEpoch()
+	{
+		RtcRegs regs;
+		if (rtcDevReadReg(pRTC, CHIP::iTimeReg, regs.uc, 7) != 0)
+			return -1;
+		return RtcCalendar::toEpoch(CHIP::decode(regs));
+	} /* getEpoch() */
+
+	// returns 0 for success, -1 for error (or a time the chip can't hold)
+	int setEpoch(int64_t llTime)
+	{
+		if (llTime < CHIP::llMinEpoch || llTime >= 4102444800LL) // up to the end of 2099
+			return -1;
+		RtcRegs regs = frame(llTime);
+		return rtcDevWriteReg(pRTC, CHIP::iTimeReg, regs.uc, 7);
+	} /* setEpoch() */
+
+	int getTime(struct tm *pTime)
+	{
+		RtcRegs regs;
+		if (rtcDevReadReg(pRTC, CHIP::iTimeReg, regs.uc, 7) != 0)
+			return -1;
+		regs = CHIP::decode(regs);
+		memset(pTime, 0, sizeof(struct tm));
+		pTime->tm_sec = RtcCalendar::bcd2bin(regs.uc[0]);
+		pTime->tm_min = RtcCalendar::bcd2bin(regs.uc[1]);
+		if (regs.uc[2] & 64) // 12 hour format
+			pTime->tm_hour = RtcCalendar::bcd2bin(regs.uc[2] & 0x1f) % 12 + ((regs.uc[2] >> 5) & 1) * 12;
+		else
+			pTime->tm_hour = RtcCalendar::bcd2bin(regs.uc[2] & 0x3f);
+		pTime->tm_wday = regs.uc[3] - 1;
+		pTime->tm_mday = RtcCalendar::bcd2bin(regs.uc[4]);
+		pTime->tm_mon = RtcCalendar::bcd2bin(regs.uc[5] & 0x1f) - 1;
+		pTime->tm_year = ((regs.uc[5] >> 7) * 100) + RtcCalendar::bcd2bin(regs.uc[6]);
+		return 0;
+	} /* getTime() */
+
+	int setTime(struct tm *pTime)
+	{
+		RtcRegs regs;
+		regs.uc[0] = RtcCalendar::bin2bcd(pTime->tm_sec);
+		regs.uc[1] = RtcCalendar::bin2bcd(pTime->tm_min);
+		regs.uc[2] = RtcCalendar::bin2bcd(pTime->tm_hour);
+		regs.uc[3] = (unsigned char)(pTime->tm_wday + 1);
+		regs.uc[4] = RtcCalendar::bin2bcd(pTime->tm_mday);
+		regs.uc[5] = (unsigned char)(RtcCalendar::bin2bcd(pTime->tm_mon + 1) | ((pTime->tm_year >= 100) << 7));
+		regs.uc[6] = RtcCalendar::bin2bcd(pTime->tm_year % 100);
+		regs = CHIP::encode(regs);
+		return rtcDevWriteReg(pRTC, CHIP::iTimeReg, regs.uc, 7);
+	} /* setTime() */
+
+	// celcius * 4
+	int getTemp()
+	{
+		static_assert(CHIP::bTemp, "this RTC has no temperature sensor");
+		return rtcDevGetTemp(pRTC);
+	} /* getTemp() */
+
+	// The RV-3032's free running UNIX time counter
+	// returns -1 for error
+	int64_t getCounter()
+	{
+		static_assert(CHIP::bUnixCounter, "this RTC has no UNIX time counter");
+		unsigned char ucTemp[4];
+		if (rtcDevReadReg(pRTC, CHIP::iUnixReg, ucTemp, 4) != 0)
+			return -1;
+		return ucTemp[0] | (ucTemp[1] << 8) | (ucTemp[2] << 16) | ((int64_t)ucTemp[3] << 24);
+	} /* getCounter() */
+
+	// TYPE = ALARM_SECOND, ALARM_TIME, etc.
+	template <int TYPE>
+	int setAlarm(struct tm *pTime)
+	{
+		static_assert(TYPE >= ALARM_SECOND && TYPE <= ALARM_DATE, "unknown alarm type");
+		static_assert(TYPE != ALARM_DAY || CHIP::bWeekdayAlarm, "this RTC has no weekday alarm");
+		return rtcDevSetAlarm(pRTC, TYPE, pTime);
+	} /* setAlarm() */
+
+	int clearAlarms() { return rtcDevClearAlarms(pRTC); }
+	int disableAlarms(int iAlarms) { return rtcDevDisableAlarms(pRTC, iAlarms); }
+
+private:
+	rtc_dev *pRTC;
+};
+
+//
+// An EEPROM of type PART
+//
+template <class PART>
+class Eeprom {
+public:
+	static constexpr int iSize = PART::iSize;
+	static constexpr int iPageSize = PART::iPageSize;
+
+	Eeprom() : pEE(NULL) {}
+	~Eeprom() { close(); }
+	Eeprom(const Eeprom &) = delete;
+	Eeprom &operator=(const Eeprom &) = delete;
+
+	// returns 0 for success, -1 for error
+	int open(int iChannel, int iAddr)
+	{
+		ee_geometry geom = {PART::iSize, PART::iPageSize, PART::iAddrBytes, PART::iWriteUs};
+
+		close();
+		pEE = eeOpen(iChannel, iAddr);
+		if (pEE != NULL && eeDevSetGeometry(pEE, &geom) != 0)
+			close();
+		return (pEE != NULL) ? 0 : -1;
+	} /* open() */
+
+	void close()
+	{
+		eeClose(pEE);
+		pEE = NULL;
+	} /* close() */
+
+	ee_dev *handle() const { return pEE; }
+
+	int read(int iAddr, unsigned char *pData, int iLen) { return eeDevRead(pEE, iAddr, pData, iLen); }
+	int write(int iAddr, unsigned char *pData, int iLen) { return eeDevWrite(pEE, iAddr, pData, iLen); }
+	int waitReady() { return eeDevWaitReady(pEE, 0); }
+
+	// Fixed locations are checked against the size of the part at compile time
+	template <int ADDR, int LEN>
+	int read(unsigned char *pData)
+	{
+		static_assert(ADDR >= 0 && LEN > 0 && ADDR + LEN <= PART::iSize, "outside the EEPROM");
+		return eeDevRead(pEE, ADDR, pData, LEN);
+	} /* read() */
+
+	template <int ADDR, int LEN>
+	int write(unsigned char *pData)
+	{
+		static_assert(ADDR >= 0 && LEN > 0 && ADDR + LEN <= PART::iSize, "outside the EEPROM");
+		return eeDevWrite(pEE, ADDR, pData, LEN);
+	} /* write() */
+
+private:
+	ee_dev *pEE;
+};
+
+#endif // __RTC_HPP__
@@ -0,0 +1,131 @@
+//
+// DS3231 and xxx
+// Real Time Clock + EEPROM library
+// Alarm interrupt events
+//
+// The DS3231 pulls its INT/SQW pin low when an enabled alarm fires.
+// Wiring that pin to a GPIO lets a program sleep in poll/epoll until
+// then instead of polling the status register over I2C.
+//
+// Written by Larry Bank
+// Copyright (c) 2018 BitBank Software, Inc.
+// bitbank@pobox.com
+//
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "rtc.h"
+#include "rtc_priv.h"
+
+//
+// Request the GPIO line connected to the RTC's INT pin
+// szChip is the GPIO character device (e.g. "/dev/gpiochip0")
+// and iLine the offset of the line on that chip
+// returns a file handle which becomes readable on each interrupt
+// (usable with poll/epoll; call rtcAlarmAck() when it fires)
+// or -1 for error
+//
+int rtcAlarmOpen(rtc_dev *pRTC, const char *szChip, int iLine)
+{
+struct gpio_v2_line_request req;
+int fd, rc;
+
+	rtcAlarmClose(pRTC);
+	fd = open(szChip, O_RDWR);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Failed to open %s\n", szChip);
+		return -1;
+	}
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = iLine;
+	req.num_lines = 1;
+	strcpy(req.consumer, "rtc-alarm");
+	// INT is open drain and active low
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_FALLING | GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+	rc = ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req);
+	if (rc < 0) // not every chip can set the bias; rely on an external pull-up
+	{
+		req.config.flags &= ~GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+		rc = ioctl(fd, GPIO_V2_GET_LINE_IOCTL, &req);
+	}
+	close(fd); // the line handle stays valid on its own
+	if (rc < 0)
+	{
+		fprintf(stderr, "Failed to request GPIO line %d\n", iLine);
+		return -1;
+	}
+	fcntl(req.fd, F_SETFL, fcntl(req.fd, F_GETFL) | O_NONBLOCK);
+	pRTC->iAlarmFd = req.fd;
+	return req.fd;
+} /* rtcAlarmOpen() */
+
+//
+// Release the GPIO line
+//
+void rtcAlarmClose(rtc_dev *pRTC)
+{
+	if (pRTC->iAlarmFd >= 0)
+		close(pRTC->iAlarmFd);
+	pRTC->iAlarmFd = -1;
+} /* rtcAlarmClose() */
+
+//
+// Handle an interrupt
+// Discards the queued edge events, then has the chip driver read the
+// status register and clear the alarm flags which are set so the pin
+// is released
+// returns a mask of RTC_ALARM1/RTC_ALARM2 for the alarms which fired,
+// or -1 for error
+//
+int rtcAlarmAck(rtc_dev *pRTC)
+{
+struct gpio_v2_line_event events[16];
+
+	if (pRTC->iAlarmFd >= 0)
+	{
+		while (read(pRTC->iAlarmFd, events, sizeof(events)) > 0) {}
+	}
+	return (*pRTC->pChip->pfnAckAlarms)(pRTC);
+} /* rtcAlarmAck() */
+
+//
+// Wait for an alarm interrupt
+// iTimeoutMs = -1 waits forever
+// returns a mask of RTC_ALARM1/RTC_ALARM2 for the alarms which fired,
+// 0 for timeout or -1 for error
+//
+int rtcAlarmWait(rtc_dev *pRTC, int iTimeoutMs)
+{
+struct gpio_v2_line_values values;
+struct pollfd pfd;
+int rc;
+
+	if (pRTC->iAlarmFd < 0)
+		return -1;
+	// The pin is level triggered; if it's already low there won't be
+	// another edge until the pending flags are cleared
+	memset(&values, 0, sizeof(values));
+	values.mask = 1;
+	if (ioctl(pRTC->iAlarmFd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) == 0 && (values.bits & 1) == 0)
+	{
+		rc = rtcAlarmAck(pRTC);
+		if (rc != 0)
+			return rc;
+	}
+	pfd.fd = pRTC->iAlarmFd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	do {
+		rc = poll(&pfd, 1, iTimeoutMs);
+		if (rc <= 0)
+			return rc; // timeout or error
+		rc = rtcAlarmAck(pRTC);
+	} while (rc == 0 && iTimeoutMs < 0); // noise on the line; keep waiting
+	return rc;
+} /* rtcAlarmWait() */
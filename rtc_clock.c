@@ -0,0 +1,311 @@
+//
+// DS3231 and xxx
+// Real Time Clock + EEPROM library
+// Cached high resolution clock
+//
+// Reading the RTC costs a 7 byte I2C transaction for every timestamp.
+// Instead, find the exact moment the seconds register rolls over, pair it
+// with CLOCK_BOOTTIME and interpolate from memory. A background thread
+// repeats this periodically and tracks the rate difference of the two
+// clocks so the interpolation stays on the RTC's time scale.
+//
+// Written by Larry Bank
+// Copyright (c) 2018 BitBank Software, Inc.
+// bitbank@pobox.com
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "rtc.h"
+#include "rtc_priv.h"
+
+#define NS_PER_SEC 1000000000LL
+#define EDGE_GUARD 5000000LL // start polling this long before an expected edge (ns)
+#define EDGE_TIMEOUT 1500000000LL // the seconds register must change within this (ns)
+#define MAX_DRIFT 1000000LL // a rate error beyond 1000ppm is a bad sample, not the crystal (ppb)
+
+//
+// CLOCK_BOOTTIME keeps counting during a suspend like the RTC does;
+// CLOCK_MONOTONIC stops, which would look like a huge drift
+//
+static int64_t rtcBootNs(void)
+{
+struct timespec ts;
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	return (ts.tv_sec * NS_PER_SEC) + ts.tv_nsec;
+} /* rtcBootNs() */
+
+//
+// Start/end a change to the shared clock fields
+// (called with the clock mutex held)
+//
+static void rtcClockWriteBegin(rtc_clock *pClock)
+{
+	__atomic_store_n(&pClock->uiSeq, pClock->uiSeq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+} /* rtcClockWriteBegin() */
+
+static void rtcClockWriteEnd(rtc_clock *pClock)
+{
+	__atomic_store_n(&pClock->uiSeq, pClock->uiSeq + 1, __ATOMIC_RELEASE);
+} /* rtcClockWriteEnd() */
+
+//
+// Prepare the clock state of a newly opened RTC
+//
+void rtcClockInit(rtc_dev *pRTC)
+{
+pthread_condattr_t attr;
+
+	pthread_mutex_init(&pRTC->clock.mutex, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&pRTC->clock.cond, &attr);
+	pthread_condattr_destroy(&attr);
+} /* rtcClockInit() */
+
+//
+// Release the clock state of an RTC being closed
+//
+void rtcClockFree(rtc_dev *pRTC)
+{
+	rtcClockStop(pRTC);
+	pthread_cond_destroy(&pRTC->clock.cond);
+	pthread_mutex_destroy(&pRTC->clock.mutex);
+} /* rtcClockFree() */
+
+//
+// Discard the cached time (e.g. after the RTC was set)
+// A running sync thread is woken to take a fresh sample
+//
+void rtcClockInvalidate(rtc_dev *pRTC)
+{
+rtc_clock *pClock = &pRTC->clock;
+
+	pthread_mutex_lock(&pClock->mutex);
+	rtcClockWriteBegin(pClock);
+	pClock->bValid = 0;
+	pClock->llAnchorBoot = 0; // the old drift baseline is meaningless now
+	pClock->llDrift = 0;
+	rtcClockWriteEnd(pClock);
+	pthread_cond_signal(&pClock->cond);
+	pthread_mutex_unlock(&pClock->mutex);
+} /* rtcClockInvalidate() */
+
+//
+// Sample the RTC on a seconds edge and update the cached clock
+// Blocks until the next edge (up to 1 second, or a few ms when the
+// clock is already synchronized)
+// returns 0 for success, -1 for error
+//
+int rtcClockSync(rtc_dev *pRTC)
+{
+rtc_clock *pClock = &pRTC->clock;
+unsigned char ucSec, ucLast;
+int64_t llStart, llBefore, llAfter, llPrev, llEdge, llRTC, llNow, llDelta, llDrift;
+struct timespec ts;
+
+	if (pClock->bValid) // sleep until just before the expected edge
+	{
+		llNow = rtcNow(pRTC);
+		llDelta = NS_PER_SEC - (llNow % NS_PER_SEC) - EDGE_GUARD;
+		if (llDelta > 0)
+		{
+			ts.tv_sec = llDelta / NS_PER_SEC;
+			ts.tv_nsec = llDelta % NS_PER_SEC;
+			nanosleep(&ts, NULL);
+		}
+	}
+	// The register is sampled somewhere inside each transaction; use the
+	// midpoint of each read and put the edge halfway between the last
+	// read before it and the first read after it
+	llStart = llBefore = rtcBootNs();
+	if (i2cReadReg(pRTC->pBus, pRTC->iAddr, pRTC->pChip->ucTimeReg, &ucLast, 1) != 0)
+		return -1;
+	llAfter = rtcBootNs();
+	llPrev = (llBefore + llAfter) / 2;
+	while (1)
+	{
+		llBefore = rtcBootNs();
+		if (i2cReadReg(pRTC->pBus, pRTC->iAddr, pRTC->pChip->ucTimeReg, &ucSec, 1) != 0)
+			return -1;
+		llAfter = rtcBootNs();
+		if (ucSec != ucLast)
+			break;
+		if (llAfter - llStart > EDGE_TIMEOUT) // oscillator is stopped
+			return -1;
+		llPrev = (llBefore + llAfter) / 2;
+	}
+	llEdge = (llPrev + ((llBefore + llAfter) / 2)) / 2;
+	// now read the full time; there is most of a second before it changes
+	llRTC = rtcDevGetEpoch(pRTC);
+	if (llRTC < 0)
+		return -1;
+	if (llRTC % 60 != BCD2BIN(ucSec & 0x7f)) // (PCF8563 VL flag)
+		return -1; // got preempted for too long
+	llRTC *= NS_PER_SEC;
+
+	pthread_mutex_lock(&pClock->mutex);
+	rtcClockWriteBegin(pClock);
+	if (pClock->bValid) // how far off was the interpolation?
+	{
+		llDelta = llEdge - pClock->llBaseBoot;
+		pClock->llOffset = llRTC - (pClock->llBaseRTC + llDelta + ((llDelta / 1000) * pClock->llDrift) / 1000000);
+	}
+	if (pClock->llAnchorBoot == 0) // first sample; start measuring drift from here
+	{
+		pClock->llAnchorBoot = llEdge;
+		pClock->llAnchorRTC = llRTC;
+		pClock->llDrift = 0;
+	}
+	else if (llEdge > pClock->llAnchorBoot)
+	{
+		// rate over the whole baseline; the edge jitter averages out as it grows
+		// (in floating point; the ns difference * 1e9 overflows 64 bits after days)
+		llDelta = llEdge - pClock->llAnchorBoot;
+		llDrift = (int64_t)(((double)((llRTC - pClock->llAnchorRTC) - llDelta) * NS_PER_SEC) / llDelta);
+		if (llDrift > MAX_DRIFT || llDrift < -MAX_DRIFT)
+		{
+			// the RTC was set behind our back or the host clock jumped; start over
+			pClock->llAnchorBoot = llEdge;
+			pClock->llAnchorRTC = llRTC;
+			llDrift = 0;
+		}
+		pClock->llDrift = llDrift;
+	}
+	pClock->llBaseBoot = llEdge;
+	pClock->llBaseRTC = llRTC;
+	pClock->bValid = 1;
+	rtcClockWriteEnd(pClock);
+	pthread_mutex_unlock(&pClock->mutex);
+	return 0;
+} /* rtcClockSync() */
+
+//
+// Background thread which re-syncs the clock every iResync seconds
+// (or right away when woken by rtcClockInvalidate)
+//
+static void *rtcClockThread(void *pArg)
+{
+rtc_dev *pRTC = (rtc_dev *)pArg;
+rtc_clock *pClock = &pRTC->clock;
+struct timespec ts;
+
+	pthread_mutex_lock(&pClock->mutex);
+	while (pClock->bRunning)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_sec += (pClock->bValid) ? pClock->iResync : 1;
+		pthread_cond_timedwait(&pClock->cond, &pClock->mutex, &ts);
+		if (!pClock->bRunning)
+			break;
+		pthread_mutex_unlock(&pClock->mutex);
+		rtcClockSync(pRTC); // a failure is retried on the next pass
+		pthread_mutex_lock(&pClock->mutex);
+	}
+	pthread_mutex_unlock(&pClock->mutex);
+	return NULL;
+} /* rtcClockThread() */
+
+//
+// Start serving rtcNow() from memory
+// Does the first sync before returning and then re-syncs every
+// iResync seconds in the background
+// returns 0 for success, -1 for error
+//
+int rtcClockStart(rtc_dev *pRTC, int iResync)
+{
+rtc_clock *pClock = &pRTC->clock;
+
+	if (iResync < 1)
+		iResync = 1;
+	pthread_mutex_lock(&pClock->mutex);
+	pClock->iResync = iResync;
+	if (pClock->bRunning) // just change the interval
+	{
+		pthread_mutex_unlock(&pClock->mutex);
+		return 0;
+	}
+	pthread_mutex_unlock(&pClock->mutex);
+	if (rtcClockSync(pRTC) != 0)
+		return -1;
+	pthread_mutex_lock(&pClock->mutex);
+	pClock->bRunning = 1;
+	if (pthread_create(&pClock->thread, NULL, rtcClockThread, pRTC) != 0)
+		pClock->bRunning = 0;
+	pthread_mutex_unlock(&pClock->mutex);
+	return (pClock->bRunning) ? 0 : -1;
+} /* rtcClockStart() */
+
+//
+// Stop the sync thread
+// rtcNow() keeps interpolating from the last sample
+//
+void rtcClockStop(rtc_dev *pRTC)
+{
+rtc_clock *pClock = &pRTC->clock;
+
+	pthread_mutex_lock(&pClock->mutex);
+	if (!pClock->bRunning)
+	{
+		pthread_mutex_unlock(&pClock->mutex);
+		return;
+	}
+	pClock->bRunning = 0;
+	pthread_cond_signal(&pClock->cond);
+	pthread_mutex_unlock(&pClock->mutex);
+	pthread_join(pClock->thread, NULL);
+} /* rtcClockStop() */
+
+//
+// Current RTC time in ns since 1970
+// Served from memory once the clock is synchronized, otherwise
+// read from the device (whole seconds only)
+// returns -1 for error
+//
+int64_t rtcNow(rtc_dev *pRTC)
+{
+rtc_clock *pClock = &pRTC->clock;
+unsigned int uiSeq;
+int64_t llBaseBoot, llBaseRTC, llDrift, llDelta;
+int bValid;
+
+	do {
+		uiSeq = __atomic_load_n(&pClock->uiSeq, __ATOMIC_ACQUIRE);
+		bValid = pClock->bValid;
+		llBaseBoot = pClock->llBaseBoot;
+		llBaseRTC = pClock->llBaseRTC;
+		llDrift = pClock->llDrift;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((uiSeq & 1) || uiSeq != __atomic_load_n(&pClock->uiSeq, __ATOMIC_RELAXED));
+
+	if (!bValid)
+	{
+		llBaseRTC = rtcDevGetEpoch(pRTC);
+		return (llBaseRTC < 0) ? -1 : llBaseRTC * NS_PER_SEC;
+	}
+	llDelta = rtcBootNs() - llBaseBoot;
+	return llBaseRTC + llDelta + ((llDelta / 1000) * llDrift) / 1000000;
+} /* rtcNow() */
+
+//
+// Get the measured rate of the RTC relative to CLOCK_BOOTTIME in ppb
+// (positive = RTC runs fast) and the error of the interpolated time
+// found at the last re-sync in ns
+// returns 0 for success, -1 if the clock has not been synchronized
+//
+int rtcClockGetDrift(rtc_dev *pRTC, int64_t *pDrift, int64_t *pOffset)
+{
+rtc_clock *pClock = &pRTC->clock;
+int rc;
+
+	pthread_mutex_lock(&pClock->mutex);
+	rc = (pClock->bValid) ? 0 : -1;
+	if (pDrift) *pDrift = pClock->llDrift;
+	if (pOffset) *pOffset = pClock->llOffset;
+	pthread_mutex_unlock(&pClock->mutex);
+	return rc;
+} /* rtcClockGetDrift() */
@@ -0,0 +1,259 @@
+//
+// DS3231 and xxx
+// Real Time Clock + EEPROM library
+// DS3231 driver
+//
+// Register map: 0x00-0x06 time, 0x07-0x0A alarm 1, 0x0B-0x0D alarm 2,
+// 0x0E control, 0x0F status (OSF, A2F, A1F), 0x10 aging offset,
+// 0x11-0x12 temperature. The time registers are the library's native
+// layout, so there's nothing to convert.
+//
+// Written by Larry Bank
+// Copyright (c) 2018 BitBank Software, Inc.
+// bitbank@pobox.com
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "rtc.h"
+#include "rtc_priv.h"
+
+// control register (0x0E) bits
+#define DS_BBSQW 0x40 // square wave on battery
+#define DS_INTCN 0x04 // INT/SQW pin = alarm interrupt
+#define DS_A2IE 0x02
+#define DS_A1IE 0x01
+
+//
+// Check the chip is there and let it keep time on the battery
+// A missing device NAKs the read; the unused register bits tell a
+// DS3231 from another chip at the same address (the temperature can't,
+// it's legitimately 0 at 0C)
+// returns 0 for success, -1 for error
+//
+static int ds3231Init(rtc_dev *pRTC)
+{
+	// alarms, control, status, aging and temperature in one read
+	if (rtcShadowLoad(pRTC) != 0 || DS3231_ZERO_BITS(pRTC->ucShadow) != 0)
+		return -1;
+	// turn off square wave on battery, enable time on battery
+	return rtcShadowUpdate(pRTC, 0xe, DS_BBSQW | DS_INTCN, 0);
+} /* ds3231Init() */
+
+//
+// The time registers are already in the DS3231 layout
+//
+static void ds3231Decode(unsigned char *pRegs)
+{
+	(void)pRegs;
+} /* ds3231Decode() */
+
+static void ds3231Encode(unsigned char *pFrame)
+{
+	pFrame[0] = 0; // start at register 0
+} /* ds3231Encode() */
+
+//
+// Read the current internal temperature
+// Value is celcius * 4 (resolution of 0.25C)
+//
+static int ds3231GetTemp(rtc_dev *pRTC)
+{
+unsigned char ucTemp[2];
+int rc, iTemp = 0;
+
+	rc = i2cReadReg(pRTC->pBus, pRTC->iAddr, 0x11, ucTemp, 2); // MSB location
+	if (rc == 0)
+	{
+		iTemp = ucTemp[0] << 8; // high byte
+		iTemp |= ucTemp[1]; // low byte
+		iTemp >>= 6; // lower 2 bits are fraction; upper 8 bits = integer part
+	}
+	return iTemp;
+} /* ds3231GetTemp() */
+
+//
+// Set Alarm for:
+// ALARM_SECOND = Once every second (alarm 1)
+// ALARM_MINUTE = Once every minute (alarm 2)
+// ALARM_TIME = When a specific hour:second match (alarm 1)
+// ALARM_DAY = When a specific day of the week and time match (alarm 1)
+// ALARM_DATE = When a specific day of the month and time match (alarm 1)
+// The alarm registers and the control register are contiguous, so the
+// alarm and its interrupt enable go out in one write. Only the INTCN and
+// alarm enable bits of the control register are changed.
+// returns 0 for success, -1 for error
+//
+static int ds3231SetAlarm(rtc_dev *pRTC, unsigned char type, struct tm *pTime)
+{
+unsigned char ucTemp[8];
+int rc = -1;
+
+  i2cBusLock(pRTC->pBus);
+  // registers 7-0xE: alarm 1, alarm 2, control
+  if (rtcShadowRead(pRTC, 0x7, ucTemp, 8) == 0)
+  {
+    ucTemp[7] = (ucTemp[7] & ~(DS_A1IE | DS_A2IE)) | DS_INTCN;
+    switch (type)
+    {
+      case ALARM_SECOND: // turn on repeating alarm for every second
+        ucTemp[0] = 0x80; // set bit 7 in the 4 registers to tell it a repeating alarm
+        ucTemp[1] = 0x80;
+        ucTemp[2] = 0x80;
+        ucTemp[3] = 0x80;
+        ucTemp[7] |= DS_A1IE;
+        rc = rtcShadowWrite(pRTC, 0x7, ucTemp, 8);
+        break;
+      case ALARM_MINUTE: // turn on repeating alarm for every minute
+        ucTemp[4] = 0x80; // set bit 7 in the 3 registers to tell it a repeating alarm
+        ucTemp[5] = 0x80;
+        ucTemp[6] = 0x80;
+        ucTemp[7] |= DS_A2IE;
+        rc = rtcShadowWrite(pRTC, 0xb, &ucTemp[4], 4);
+        break;
+      case ALARM_TIME: // turn on alarm to match a specific time
+      case ALARM_DAY: // turn on alarm for a specific day of the week
+      case ALARM_DATE: // turn on alarm for a specific date
+// Values are stored as BCD
+        ucTemp[0] = BIN2BCD(pTime->tm_sec);
+        ucTemp[1] = BIN2BCD(pTime->tm_min);
+        ucTemp[2] = BIN2BCD(pTime->tm_hour); // (and set 24-hour format)
+        // set the A1Mx bits (high bits of the 4 registers)
+        // for the specific type of alarm
+        if (type == ALARM_TIME) // A1Mx bits should be 1000
+          ucTemp[3] = 0x80; // ignore the day
+        else if (type == ALARM_DAY) // A1Mx bits should be 0000 + DY/DT
+          ucTemp[3] = 0x40 | (pTime->tm_wday + 1);
+        else // for matching the date, all bits are left as 0's (0000)
+          ucTemp[3] = BIN2BCD(pTime->tm_mday);
+        ucTemp[7] |= DS_A1IE;
+        rc = rtcShadowWrite(pRTC, 0x7, ucTemp, 8);
+        break;
+    } // switch on type
+  }
+  i2cBusUnlock(pRTC->pBus);
+  return rc;
+} /* ds3231SetAlarm() */
+
+//
+// Reset the "fired" bits for Alarm 1 and 2
+// The flags can only be written to 0, so OSF is written as 1 to keep
+// it and EN32kHz comes from the shadow copy
+// returns 0 for success, -1 for error
+//
+static int ds3231ClearAlarms(rtc_dev *pRTC)
+{
+unsigned char ucTemp[2];
+int rc = -1;
+
+  i2cBusLock(pRTC->pBus);
+  if (rtcShadowRead(pRTC, 0xf, &ucTemp[1], 1) == 0)
+  {
+    ucTemp[0] = 0xf; // status register
+    ucTemp[1] = 0x80 | (ucTemp[1] & 0x08); // clear A1F & A2F (alarm 1 or 2 fired) bit to allow it to fire again
+    rc = i2cWriteData(pRTC->pBus, pRTC->iAddr, ucTemp, 2);
+    if (rc == 0)
+      pRTC->ucShadow[0xf] &= ~(RTC_ALARM1 | RTC_ALARM2);
+    else
+      pRTC->bShadowValid = 0;
+  }
+  i2cBusUnlock(pRTC->pBus);
+  return rc;
+} /* ds3231ClearAlarms() */
+
+//
+// Turn off the alarm interrupts (A1IE/A2IE are bits 0/1 like the
+// RTC_ALARM1/2 flags)
+// returns 0 for success, -1 for error
+//
+static int ds3231DisableAlarms(rtc_dev *pRTC, int iAlarms)
+{
+  return rtcShadowUpdate(pRTC, 0xe, (unsigned char)(iAlarms & (DS_A1IE | DS_A2IE)), 0);
+} /* ds3231DisableAlarms() */
+
+//
+// Read the status register and clear the alarm flags which are set
+// returns a mask of RTC_ALARM1/RTC_ALARM2 or -1 for error
+//
+static int ds3231AckAlarms(rtc_dev *pRTC)
+{
+unsigned char ucTemp[2];
+int iFired;
+
+	i2cBusLock(pRTC->pBus);
+	if (i2cReadReg(pRTC->pBus, pRTC->iAddr, 0xf, &ucTemp[1], 1) != 0)
+	{
+		i2cBusUnlock(pRTC->pBus);
+		return -1;
+	}
+	iFired = ucTemp[1] & (RTC_ALARM1 | RTC_ALARM2); // A1F = bit 0, A2F = bit 1
+	if (iFired)
+	{
+		// The flags can only be written to 0; writing a 1 leaves them
+		// unchanged, so an alarm which fires right now is not lost
+		ucTemp[0] = 0xf;
+		ucTemp[1] = (ucTemp[1] | 3) & ~iFired;
+		if (i2cWriteData(pRTC->pBus, pRTC->iAddr, ucTemp, 2) != 0)
+			iFired = -1;
+	}
+	i2cBusUnlock(pRTC->pBus);
+	return iFired;
+} /* ds3231AckAlarms() */
+
+//
+// Registers 0-0x12 (time, alarms, control, status, aging, temperature)
+// in one read
+// returns 0 for success, -1 for error
+//
+static int ds3231Snapshot(rtc_dev *pRTC, rtc_snapshot *pSnap)
+{
+unsigned char ucRegs[0x13], *pReg;
+rtc_alarm_info *pAlarm;
+int i;
+
+	if (rtcDevReadReg(pRTC, 0, ucRegs, sizeof(ucRegs)) != 0)
+		return -1;
+	pSnap->llTime = rtcDecodeEpoch(ucRegs);
+	pSnap->iTemp = ((ucRegs[0x11] << 8) | ucRegs[0x12]) >> 6; // as ds3231GetTemp()
+	pSnap->iAging = (signed char)ucRegs[0x10];
+	pSnap->ucControl = ucRegs[0xe];
+	pSnap->ucStatus = ucRegs[0xf];
+	pSnap->bOscStopped = ucRegs[0xf] >> 7; // OSF
+	pSnap->bBusy = (ucRegs[0xf] >> 2) & 1; // BSY
+	pSnap->iFired = ucRegs[0xf] & (RTC_ALARM1 | RTC_ALARM2);
+	for (i=0; i<2; i++)
+	{
+		// alarm 2 (0x0B-0x0D) is alarm 1 (0x07-0x0A) without the seconds
+		pReg = &ucRegs[(i == 0) ? 7 : 0xa];
+		pAlarm = &pSnap->alarm[i];
+		pAlarm->bEnabled = (ucRegs[0xe] >> i) & 1; // A1IE, A2IE
+		pAlarm->iSec = (i == 0) ? ALARM2BIN(pReg[0], 0x7f) : 0;
+		pAlarm->iMin = ALARM2BIN(pReg[1], 0x7f);
+		pAlarm->iHour = ALARM2BIN(pReg[2], 0x3f);
+		if (pReg[3] & 0x80)
+			pAlarm->iDay = -1;
+		else if (pReg[3] & 0x40) // DY/DT
+		{
+			pAlarm->iDay = (pReg[3] & 7) - 1;
+			pAlarm->bWeekday = 1;
+		}
+		else
+			pAlarm->iDay = BCD2BIN(pReg[3] & 0x3f);
+	}
+	return 0;
+} /* ds3231Snapshot() */
+
+const rtc_chip rtcChipDS3231 = {
+	RTC_DS3231,
+	0, // time registers start at 0
+	{{0x07, 12}, {0, 0}}, // alarms, control, status, aging, temperature
+	ds3231Init,
+	ds3231Decode,
+	ds3231Encode,
+	ds3231GetTemp,
+	ds3231SetAlarm,
+	ds3231ClearAlarms,
+	ds3231DisableAlarms,
+	ds3231AckAlarms,
+	ds3231Snapshot
+};
@@ -0,0 +1,254 @@
+//
+// DS3231 and xxx
+// Real Time Clock + EEPROM library
+// PCF8563 driver
+//
+// Register map: 0x00-0x01 control/status (AF = bit 3 and TF = bit 2 of
+// 0x01), 0x02-0x08 time (seconds with the VL flag in bit 7, minutes,
+// hours, date, weekday 0-6, month + century bit, year), 0x09-0x0C alarm
+// (minute, hour, date, weekday; bit 7 = ignore), 0x0D CLKOUT,
+// 0x0E-0x0F countdown timer. There's no temperature sensor.
+// The alarm has no seconds register, so it fires at second 00 of the
+// matching minute; the repeating alarms use the countdown timer, whose
+// flag is reported as RTC_ALARM2 (the alarm's is RTC_ALARM1).
+//
+// Written by Larry Bank
+// Copyright (c) 2018 BitBank Software, Inc.
+// bitbank@pobox.com
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "rtc.h"
+#include "rtc_priv.h"
+
+#define PCF_AF 8 // alarm flag
+#define PCF_TF 4 // timer flag
+#define PCF_AIE 2 // alarm interrupt enable
+#define PCF_TIE 1 // timer interrupt enable
+
+//
+// Check the chip is there and make sure the clock is running
+// returns 0 for success, -1 for error
+//
+static int pcf8563Init(rtc_dev *pRTC)
+{
+	// all 16 registers in one read
+	if (rtcShadowLoad(pRTC) != 0)
+		return -1;
+	return rtcShadowUpdate(pRTC, 0, 0xa8, 0); // clear TEST1, STOP and TESTC
+} /* pcf8563Init() */
+
+//
+// The date comes before the weekday (0-6) and the unused bits
+// aren't guaranteed to read as 0
+//
+static void pcf8563Decode(unsigned char *pRegs)
+{
+unsigned char ucDate = pRegs[3];
+
+	pRegs[0] &= 0x7f; // VL flag
+	pRegs[1] &= 0x7f;
+	pRegs[2] &= 0x3f;
+	pRegs[3] = (pRegs[4] & 7) + 1;
+	pRegs[4] = ucDate & 0x3f;
+	pRegs[5] &= 0x9f;
+} /* pcf8563Decode() */
+
+static void pcf8563Encode(unsigned char *pFrame)
+{
+unsigned char ucWday = pFrame[4];
+
+	pFrame[0] = 2; // start at the seconds register
+	pFrame[4] = pFrame[5];
+	pFrame[5] = ucWday - 1;
+} /* pcf8563Encode() */
+
+static int pcf8563GetTemp(rtc_dev *pRTC)
+{
+	(void)pRTC;
+	return 0; // no sensor
+} /* pcf8563GetTemp() */
+
+//
+// Set Alarm for:
+// ALARM_SECOND = Once every second (countdown timer)
+// ALARM_MINUTE = Once every minute (countdown timer)
+// ALARM_TIME = When a specific hour:minute match
+// ALARM_DAY = When a specific day of the week and time match
+// ALARM_DATE = When a specific day of the month and time match
+// The interrupt enables come from the shadow copy, and control/status 2
+// is only written when one of them changes
+// returns 0 for success, -1 for error
+//
+static int pcf8563SetAlarm(rtc_dev *pRTC, unsigned char type, struct tm *pTime)
+{
+unsigned char ucTemp[4], ucCtrl;
+int rc = -1;
+
+	i2cBusLock(pRTC->pBus);
+	if (rtcShadowRead(pRTC, 1, &ucCtrl, 1) != 0)
+		goto done;
+	ucCtrl |= PCF_AF | PCF_TF; // writing 1 leaves the flags unchanged
+	switch (type)
+	{
+		case ALARM_SECOND:
+		case ALARM_MINUTE:
+			if (type == ALARM_SECOND)
+			{
+				ucTemp[0] = 0x81; // enabled, 64Hz source
+				ucTemp[1] = 64;
+			}
+			else
+			{
+				ucTemp[0] = 0x82; // enabled, 1Hz source
+				ucTemp[1] = 60;
+			}
+			if (rtcShadowWrite(pRTC, 0xe, ucTemp, 2) != 0) // timer control + count
+				goto done;
+			ucCtrl |= PCF_TIE;
+			break;
+		case ALARM_TIME:
+		case ALARM_DAY:
+		case ALARM_DATE:
+			ucTemp[0] = BIN2BCD(pTime->tm_min);
+			ucTemp[1] = BIN2BCD(pTime->tm_hour);
+			ucTemp[2] = (type == ALARM_DATE) ? BIN2BCD(pTime->tm_mday) : 0x80;
+			ucTemp[3] = (type == ALARM_DAY) ? pTime->tm_wday : 0x80;
+			if (rtcShadowWrite(pRTC, 9, ucTemp, 4) != 0) // minute, hour, date, weekday alarms
+				goto done;
+			ucCtrl |= PCF_AIE;
+			break;
+		default:
+			goto done;
+	}
+	rc = rtcShadowWrite(pRTC, 1, &ucCtrl, 1);
+done:
+	i2cBusUnlock(pRTC->pBus);
+	return rc;
+} /* pcf8563SetAlarm() */
+
+//
+// Reset the alarm and timer flags (the interrupts stay enabled)
+// returns 0 for success, -1 for error
+//
+static int pcf8563ClearAlarms(rtc_dev *pRTC)
+{
+unsigned char ucTemp[2];
+int rc;
+
+	i2cBusLock(pRTC->pBus);
+	rc = rtcShadowRead(pRTC, 1, &ucTemp[1], 1);
+	if (rc == 0)
+	{
+		// always written; the shadow copy can't tell if a flag is set
+		ucTemp[0] = 1; // control/status 2
+		ucTemp[1] &= ~(PCF_AF | PCF_TF);
+		rc = i2cWriteData(pRTC->pBus, pRTC->iAddr, ucTemp, 2);
+		if (rc == 0)
+			pRTC->ucShadow[1] = ucTemp[1];
+		else
+			pRTC->bShadowValid = 0;
+	}
+	i2cBusUnlock(pRTC->pBus);
+	return rc;
+} /* pcf8563ClearAlarms() */
+
+//
+// Turn off the alarm (RTC_ALARM1) and timer (RTC_ALARM2) interrupts
+// returns 0 for success, -1 for error
+//
+static int pcf8563DisableAlarms(rtc_dev *pRTC, int iAlarms)
+{
+unsigned char ucCtrl, ucClear;
+int rc;
+
+	ucClear = ((iAlarms & RTC_ALARM1) ? PCF_AIE : 0) | ((iAlarms & RTC_ALARM2) ? PCF_TIE : 0);
+	i2cBusLock(pRTC->pBus);
+	rc = rtcShadowRead(pRTC, 1, &ucCtrl, 1);
+	if (rc == 0 && (ucCtrl & ucClear))
+	{
+		ucCtrl = (ucCtrl & ~ucClear) | PCF_AF | PCF_TF; // writing 1 leaves the flags unchanged
+		rc = rtcShadowWrite(pRTC, 1, &ucCtrl, 1);
+	}
+	i2cBusUnlock(pRTC->pBus);
+	return rc;
+} /* pcf8563DisableAlarms() */
+
+//
+// Read control/status 2 and clear the flags which are set
+// returns a mask of RTC_ALARM1 (alarm) / RTC_ALARM2 (timer) or -1 for error
+//
+static int pcf8563AckAlarms(rtc_dev *pRTC)
+{
+unsigned char ucTemp[2], ucFlags;
+int iFired;
+
+	i2cBusLock(pRTC->pBus);
+	if (i2cReadReg(pRTC->pBus, pRTC->iAddr, 1, &ucTemp[1], 1) != 0)
+	{
+		i2cBusUnlock(pRTC->pBus);
+		return -1;
+	}
+	ucFlags = ucTemp[1] & (PCF_AF | PCF_TF);
+	iFired = ((ucFlags & PCF_AF) ? RTC_ALARM1 : 0) | ((ucFlags & PCF_TF) ? RTC_ALARM2 : 0);
+	if (iFired)
+	{
+		// as on the DS3231, writing a 1 leaves a flag unchanged
+		ucTemp[0] = 1;
+		ucTemp[1] = (ucTemp[1] | PCF_AF | PCF_TF) & ~ucFlags;
+		if (i2cWriteData(pRTC->pBus, pRTC->iAddr, ucTemp, 2) != 0)
+			iFired = -1;
+	}
+	i2cBusUnlock(pRTC->pBus);
+	return iFired;
+} /* pcf8563AckAlarms() */
+
+//
+// All 16 registers in one read
+// alarm[1] is the countdown timer
+// returns 0 for success, -1 for error
+//
+static int pcf8563Snapshot(rtc_dev *pRTC, rtc_snapshot *pSnap)
+{
+unsigned char ucRegs[16];
+rtc_alarm_info *pAlarm = &pSnap->alarm[0];
+
+	if (rtcDevReadReg(pRTC, 0, ucRegs, sizeof(ucRegs)) != 0)
+		return -1;
+	pSnap->bOscStopped = ucRegs[2] >> 7; // VL
+	pcf8563Decode(&ucRegs[2]);
+	pSnap->llTime = rtcDecodeEpoch(&ucRegs[2]);
+	pSnap->ucControl = ucRegs[0];
+	pSnap->ucStatus = ucRegs[1];
+	pSnap->iFired = ((ucRegs[1] & PCF_AF) ? RTC_ALARM1 : 0) | ((ucRegs[1] & PCF_TF) ? RTC_ALARM2 : 0);
+	pAlarm->bEnabled = (ucRegs[1] & PCF_AIE) != 0;
+	pAlarm->iSec = 0; // no seconds register
+	pAlarm->iMin = ALARM2BIN(ucRegs[9], 0x7f);
+	pAlarm->iHour = ALARM2BIN(ucRegs[10], 0x3f);
+	pAlarm->iDay = ALARM2BIN(ucRegs[11], 0x3f);
+	if (pAlarm->iDay < 0 && !(ucRegs[12] & 0x80))
+	{
+		pAlarm->iDay = ucRegs[12] & 7;
+		pAlarm->bWeekday = 1;
+	}
+	pAlarm = &pSnap->alarm[1];
+	pAlarm->bEnabled = (ucRegs[1] & PCF_TIE) && (ucRegs[14] & 0x80); // TIE + TE
+	pAlarm->iSec = pAlarm->iMin = pAlarm->iHour = pAlarm->iDay = -1;
+	return 0;
+} /* pcf8563Snapshot() */
+
+const rtc_chip rtcChipPCF8563 = {
+	RTC_PCF8563,
+	2, // time registers start at 2
+	{{0x00, 16}, {0, 0}}, // everything
+	pcf8563Init,
+	pcf8563Decode,
+	pcf8563Encode,
+	pcf8563GetTemp,
+	pcf8563SetAlarm,
+	pcf8563ClearAlarms,
+	pcf8563DisableAlarms,
+	pcf8563AckAlarms,
+	pcf8563Snapshot
+};
@@ -0,0 +1,144 @@
+//
+// Internal definitions shared by the modules of the RTC + EEPROM library
+// (not installed; applications only see rtc.h)
+//
+#ifndef __RTC_PRIV__
+#define __RTC_PRIV__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <linux/i2c.h>
+#include "rtc.h"
+
+#define EE_PAGE_SIZE 32 // AT24C32/64 page write buffer size
+#define EE_MAX_PAGE 256 // largest page write buffer of any supported part
+
+// BCD <-> binary for 0-99 without divides or tables
+// ((x * 103) >> 10) == x / 10 over that range
+#define BCD2BIN(x) ((x) - (6 * ((x) >> 4)))
+#define BIN2BCD(x) ((x) + (6 * (((x) * 103) >> 10)))
+// alarm register field with a "don't care" bit 7 (-1 = any)
+#define ALARM2BIN(x, mask) (((x) & 0x80) ? -1 : BCD2BIN((x) & (mask)))
+// bits of the DS3231 status (0x0F) and temperature LSB (0x12) registers
+// which always read as 0; anything else at its address has some set
+#define DS3231_ZERO_BITS(pRegs) (((pRegs)[0x0f] & 0x70) | ((pRegs)[0x12] & 0x3f))
+
+//
+// An open I2C bus
+// All devices on the same bus share one file handle; the slave address
+// travels with each message, so the handle is never bound to a device
+//
+typedef struct i2c_bus {
+	int iChannel; // the N in /dev/i2c-N
+	int fd;
+	int iRefCount; // number of devices using it
+	pthread_mutex_t mutex; // serializes multi-step sequences
+	rtc_xfer_fn pfnTransfer; // custom backend (rtcBusRegister) or NULL
+	void *pCtx;
+	rtc_bus_stats stats; // traffic counters (protected by mutex)
+	rtc_dev_stats devStats[128]; // the same per slave address
+	rtc_trace_fn pfnTrace; // transfer hook or NULL
+	void *pTraceUser;
+} i2c_bus;
+
+//
+// State of the cached clock (rtcClockStart)
+// The RTC time of one seconds edge is paired with CLOCK_BOOTTIME;
+// readers interpolate from it without touching the bus.
+// uiSeq is a sequence lock: odd while the sync thread is updating
+//
+typedef struct rtc_clock {
+	volatile unsigned int uiSeq;
+	int bValid; // base time is usable
+	int64_t llBaseBoot; // CLOCK_BOOTTIME at the last edge (ns)
+	int64_t llBaseRTC; // RTC time at the last edge (ns since 1970)
+	int64_t llDrift; // rate of the RTC relative to CLOCK_BOOTTIME (ppb)
+	int64_t llOffset; // prediction error found at the last re-sync (ns)
+	int64_t llAnchorBoot, llAnchorRTC; // first edge; the drift baseline
+	int iResync; // seconds between re-syncs
+	int bRunning; // sync thread is active
+	pthread_t thread;
+	pthread_mutex_t mutex; // lets rtcClockStop() wake the thread
+	pthread_cond_t cond;
+} rtc_clock;
+
+//
+// Chip driver (rtc_ds3231.c, rtc_pcf8563.c, rtc_rv3032.c)
+// The rest of the library works with the DS3231 time layout: seconds,
+// minutes, hours, weekday 1-7, date, month + century bit (set = 20xx),
+// year. Each driver converts its own registers to and from that layout.
+//
+typedef struct rtc_chip {
+	int iType; // RTC_DS3231, etc.
+	unsigned char ucTimeReg; // the first of the 7 time registers (seconds)
+	unsigned char ucShadow[2][2]; // {first register, count} of the windows kept in the shadow copy
+	int (*pfnInit)(rtc_dev *pRTC); // check the chip is there and set up its control registers
+	void (*pfnDecode)(unsigned char *pRegs); // 7 time registers -> DS3231 layout (in place)
+	void (*pfnEncode)(unsigned char *pFrame); // DS3231 frame (register pointer + 7) -> the chip's
+	int (*pfnGetTemp)(rtc_dev *pRTC); // celcius * 4
+	int (*pfnSetAlarm)(rtc_dev *pRTC, unsigned char type, struct tm *pTime);
+	int (*pfnClearAlarms)(rtc_dev *pRTC);
+	int (*pfnDisableAlarms)(rtc_dev *pRTC, int iAlarms); // turn off the RTC_ALARM1/2 interrupts
+	int (*pfnAckAlarms)(rtc_dev *pRTC); // clears the flags which are set; returns them as RTC_ALARM1/2
+	int (*pfnSnapshot)(rtc_dev *pRTC, rtc_snapshot *pSnap); // one burst read of everything
+} rtc_chip;
+
+extern const rtc_chip rtcChipDS3231;
+extern const rtc_chip rtcChipPCF8563;
+extern const rtc_chip rtcChipRV3032;
+
+//
+// Device contexts
+//
+struct rtc_dev {
+	i2c_bus *pBus;
+	int iAddr; // slave address
+	const rtc_chip *pChip; // chosen when the device is opened
+	unsigned char ucShadow[256]; // copy of the control, alarm and configuration registers
+	int bShadowValid; // 0 = reload it before use (e.g. after a failed write)
+	rtc_clock clock;
+	int iAlarmFd; // GPIO line of the INT pin (rtcAlarmOpen) or -1
+};
+
+struct ee_dev {
+	i2c_bus *pBus;
+	int iAddr; // slave address
+	int iSize; // capacity in bytes
+	int iPageSize; // size of the page write buffer
+	int iAddrBytes; // 1 (the block number goes in the slave address) or 2
+	int iWriteUs; // longest write cycle
+};
+
+// Bus access (rtc.c)
+i2c_bus *i2cBusOpen(int iChannel);
+void i2cBusClose(i2c_bus *pBus);
+void i2cBusLock(i2c_bus *pBus);
+void i2cBusUnlock(i2c_bus *pBus);
+int i2cTransfer(i2c_bus *pBus, struct i2c_msg *pMsgs, int iCount);
+void i2cCountRetry(i2c_bus *pBus, int iAddr);
+int i2cWriteData(i2c_bus *pBus, int iAddr, unsigned char *pData, int iLen);
+int i2cReadData(i2c_bus *pBus, int iAddr, unsigned char *pData, int iLen);
+int i2cReadReg(i2c_bus *pBus, int iAddr, unsigned char ucReg, unsigned char *pData, int iLen);
+
+// Register shadow (rtc.c)
+// Only the host changes the registers in the shadow windows, so reads
+// are served from memory and unchanged values aren't written again;
+// flag bits which the chip sets must still be read from the chip
+int rtcShadowLoad(rtc_dev *pRTC);
+int rtcShadowRead(rtc_dev *pRTC, int iReg, unsigned char *pData, int iLen);
+int rtcShadowWrite(rtc_dev *pRTC, int iReg, const unsigned char *pData, int iLen);
+int rtcShadowUpdate(rtc_dev *pRTC, int iReg, unsigned char ucClear, unsigned char ucSet);
+
+// CRC-32 (IEEE 802.3, as used by zlib) continued from ulCrc (rtc.c)
+uint32_t eeCrc32(uint32_t ulCrc, const unsigned char *pData, int iLen);
+
+// Time register frames (rtc.c)
+int64_t rtcDecodeEpoch(unsigned char *ucTemp);
+void rtcEncodeEpoch(int64_t llTime, unsigned char *ucTemp);
+
+// Cached clock (rtc_clock.c)
+void rtcClockInit(rtc_dev *pRTC);
+void rtcClockFree(rtc_dev *pRTC);
+void rtcClockInvalidate(rtc_dev *pRTC);
+
+#endif // __RTC_PRIV__
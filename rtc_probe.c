@@ -0,0 +1,203 @@
+//
+// DS3231 and xxx
+// Real Time Clock + EEPROM library
+// Device discovery
+//
+// Finds the supported RTCs and 24Cxx EEPROMs on a bus. Every candidate
+// address costs exactly one transaction: the RTC addresses get a
+// register pointer write and a burst read joined by a repeated start,
+// which both proves the chip is there and identifies it, and the EEPROM
+// addresses get a 1 byte read from the current address (a quick write
+// can corrupt some 24Cxx parts, so i2cdetect doesn't use it there
+// either). The addresses can't share one transaction because the
+// adapter abandons the rest of it at the first NAK. Buses are
+// independent, so rtcProbeBuses() probes each one in its own thread.
+//
+// Written by Larry Bank
+// Copyright (c) 2018 BitBank Software, Inc.
+// bitbank@pobox.com
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "rtc.h"
+#include "rtc_priv.h"
+
+#define DS3231_ADDR 0x68
+#define RTC51_ADDR 0x51 // PCF8563 and RV-3032
+#define EE_FIRST_ADDR 0x50 // 24Cxx address pins A2-A0 = 000-111
+#define EE_LAST_ADDR 0x57
+
+typedef struct probe_job {
+	int iChannel;
+	rtc_probe *pProbe;
+	int iFound;
+} probe_job;
+
+//
+// Check a register value is BCD in the range iMin-iMax
+//
+static int rtcProbeBCD(unsigned char uc, int iMin, int iMax)
+{
+int i;
+
+	if ((uc & 0xf) > 9)
+		return 0;
+	i = BCD2BIN(uc);
+	return (i >= iMin && i <= iMax);
+} /* rtcProbeBCD() */
+
+//
+// Check registers 0x00-0x12 belong to a DS3231: the bits of the status
+// and temperature registers which always read as 0 are clear and the
+// time registers hold a valid time (12 or 24 hour). Nothing is compared
+// across two reads of the clock, so a seconds rollover during the
+// transfer can't hide the chip
+//
+static int rtcProbeDS3231(unsigned char *pRegs)
+{
+int bHour;
+
+	if (pRegs[2] & 0x40) // 12 hour mode
+		bHour = !(pRegs[2] & 0x80) && rtcProbeBCD(pRegs[2] & 0x1f, 1, 12);
+	else
+		bHour = rtcProbeBCD(pRegs[2], 0, 23);
+	return (DS3231_ZERO_BITS(pRegs) == 0 && bHour &&
+	    rtcProbeBCD(pRegs[0], 0, 59) && rtcProbeBCD(pRegs[1], 0, 59) &&
+	    pRegs[3] >= 1 && pRegs[3] <= 7 && rtcProbeBCD(pRegs[4], 1, 31) &&
+	    rtcProbeBCD(pRegs[5] & 0x7f, 1, 12) && rtcProbeBCD(pRegs[6], 0, 99));
+} /* rtcProbeDS3231() */
+
+//
+// Identify the chip at 0x51 from registers 0x00-0x1F
+// Neither RTC has an ID register. The PCF8563's register pointer wraps
+// after 0x0F (and the time doesn't move during a transaction), so it
+// reads the same 16 bytes twice; so does an erased EEPROM, which the
+// seconds and minutes (unused bit masked) rule out. The RV-3032's 100ths
+// and time registers must hold a valid time with the unused bits clear
+// returns RTC_PCF8563, RTC_RV3032 or RTC_UNKNOWN (an EEPROM)
+//
+static int rtcProbeType51(unsigned char *pRegs)
+{
+	if (memcmp(pRegs, &pRegs[16], 16) == 0 && rtcProbeBCD(pRegs[2] & 0x7f, 0, 59) &&
+	    rtcProbeBCD(pRegs[3] & 0x7f, 0, 59))
+		return RTC_PCF8563;
+	if (rtcProbeBCD(pRegs[0], 0, 99) && rtcProbeBCD(pRegs[1], 0, 59) &&
+	    rtcProbeBCD(pRegs[2], 0, 59) && rtcProbeBCD(pRegs[3], 0, 23) &&
+	    pRegs[4] <= 6 && rtcProbeBCD(pRegs[5], 1, 31) &&
+	    rtcProbeBCD(pRegs[6], 1, 12) && rtcProbeBCD(pRegs[7], 0, 99))
+		return RTC_RV3032;
+	return RTC_UNKNOWN;
+} /* rtcProbeType51() */
+
+//
+// Add a device to the probe results
+//
+static void rtcProbeAdd(rtc_probe *pProbe, int iType, int iAddr)
+{
+	if (iType == RTC_UNKNOWN) // an EEPROM
+	{
+		if (pProbe->iEECount < RTC_PROBE_MAX_EE)
+			pProbe->iEEAddr[pProbe->iEECount++] = iAddr;
+	}
+	else if (pProbe->iRTCCount < RTC_PROBE_MAX_RTC)
+	{
+		pProbe->iRTCType[pProbe->iRTCCount] = iType;
+		pProbe->iRTCAddr[pProbe->iRTCCount++] = iAddr;
+	}
+} /* rtcProbeAdd() */
+
+//
+// Find the supported devices on one bus
+// The results go in pProbe; the RTCs can then be opened with
+// rtcOpenChip(iChannel, iRTCAddr[i], iRTCType[i]) and the EEPROMs
+// with eeOpen()
+// returns the number of devices found or -1 if the bus can't be opened
+//
+int rtcProbe(int iChannel, rtc_probe *pProbe)
+{
+i2c_bus *pBus;
+unsigned char ucRegs[32];
+int iAddr, iType;
+
+	memset(pProbe, 0, sizeof(rtc_probe));
+	pProbe->iChannel = iChannel;
+	pBus = i2cBusOpen(iChannel);
+	if (pBus == NULL)
+		return -1;
+	// DS3231: all of its registers (0x00-0x12)
+	if (i2cReadReg(pBus, DS3231_ADDR, 0, ucRegs, 0x13) == 0 && rtcProbeDS3231(ucRegs))
+		rtcProbeAdd(pProbe, RTC_DS3231, DS3231_ADDR);
+	for (iAddr = EE_FIRST_ADDR; iAddr <= EE_LAST_ADDR; iAddr++)
+	{
+		if (iAddr == RTC51_ADDR) // an RTC or an EEPROM
+		{
+			if (i2cReadReg(pBus, iAddr, 0, ucRegs, 32) != 0)
+				continue;
+			iType = rtcProbeType51(ucRegs);
+		}
+		else
+		{
+			if (i2cReadData(pBus, iAddr, ucRegs, 1) != 0)
+				continue;
+			iType = RTC_UNKNOWN;
+		}
+		rtcProbeAdd(pProbe, iType, iAddr);
+	}
+	i2cBusClose(pBus);
+	return pProbe->iRTCCount + pProbe->iEECount;
+} /* rtcProbe() */
+
+static void * rtcProbeThread(void *pArg)
+{
+probe_job *pJob = (probe_job *)pArg;
+
+	pJob->iFound = rtcProbe(pJob->iChannel, pJob->pProbe);
+	return NULL;
+} /* rtcProbeThread() */
+
+//
+// Probe iCount buses at the same time, one thread per bus
+// (the calling thread takes the first one)
+// pProbes receives the results of each bus in the same order
+// returns the total number of devices found
+//
+int rtcProbeBuses(const int *pChannels, int iCount, rtc_probe *pProbes)
+{
+probe_job *pJobs;
+pthread_t *pThreads;
+int *pStarted;
+int i, iFound = 0;
+
+	if (iCount <= 0)
+		return 0;
+	pJobs = (probe_job *)calloc(iCount, sizeof(probe_job));
+	pThreads = (pthread_t *)calloc(iCount, sizeof(pthread_t));
+	pStarted = (int *)calloc(iCount, sizeof(int));
+	if (pJobs == NULL || pThreads == NULL || pStarted == NULL)
+		goto done;
+	for (i=0; i<iCount; i++)
+	{
+		pJobs[i].iChannel = pChannels[i];
+		pJobs[i].pProbe = &pProbes[i];
+	}
+	for (i=1; i<iCount; i++)
+		pStarted[i] = (pthread_create(&pThreads[i], NULL, rtcProbeThread, &pJobs[i]) == 0);
+	rtcProbeThread(&pJobs[0]);
+	for (i=0; i<iCount; i++)
+	{
+		if (pStarted[i])
+			pthread_join(pThreads[i], NULL);
+		else if (i != 0) // no thread for it; probe it here
+			rtcProbeThread(&pJobs[i]);
+		if (pJobs[i].iFound > 0)
+			iFound += pJobs[i].iFound;
+	}
+done:
+	free(pJobs);
+	free(pThreads);
+	free(pStarted);
+	return iFound;
+} /* rtcProbeBuses() */
@@ -0,0 +1,255 @@
+//
+// DS3231 and xxx
+// Real Time Clock + EEPROM library
+// RV-3032-C7 driver
+//
+// Register map: 0x00 100ths of a second, 0x01-0x07 time (seconds,
+// minutes, hours, weekday 0-6, date, month, year; no century bit, the
+// chip counts 2000-2099), 0x08-0x0A alarm (minute, hour, date; bit 7 =
+// ignore), 0x0D status (UF = bit 5, TF = bit 4, AF = bit 3), 0x0E-0x0F
+// temperature, 0x10-0x12 control 1-3, 0x1B-0x1E UNIX time counter,
+// 0xC0 power management (RAM copy of the configuration EEPROM).
+// The alarm has no seconds or weekday register; the repeating alarms
+// use the periodic time update interrupt, whose flag is reported as
+// RTC_ALARM2 (the alarm's is RTC_ALARM1).
+//
+// Written by Larry Bank
+// Copyright (c) 2018 BitBank Software, Inc.
+// bitbank@pobox.com
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "rtc.h"
+#include "rtc_priv.h"
+
+#define RV_UF 0x20 // periodic time update flag
+#define RV_TF 0x10 // countdown timer flag
+#define RV_AF 0x08 // alarm flag
+#define RV_USEL 0x10 // control 1: time update every minute instead of every second
+#define RV_UIE 0x20 // control 2: time update interrupt enable
+#define RV_AIE 0x08 // control 2: alarm interrupt enable
+
+//
+// Check the chip is there, make sure the clock is running and let it
+// switch to the backup battery
+// returns 0 for success, -1 for error
+//
+static int rv3032Init(rtc_dev *pRTC)
+{
+	if (rtcShadowLoad(pRTC) != 0)
+		return -1;
+	if (rtcShadowUpdate(pRTC, 0x11, 1, 0) != 0) // clear STOP in control 2
+		return -1;
+	return rtcShadowUpdate(pRTC, 0xc0, 0x30, 0x10); // PMU: direct switching mode
+} /* rv3032Init() */
+
+//
+// The weekday is 0-6 and the month has no century bit
+//
+static void rv3032Decode(unsigned char *pRegs)
+{
+	pRegs[0] &= 0x7f;
+	pRegs[1] &= 0x7f;
+	pRegs[2] &= 0x3f;
+	pRegs[3] = (pRegs[3] & 7) + 1;
+	pRegs[4] &= 0x3f;
+	pRegs[5] = (pRegs[5] & 0x1f) | 0x80; // always 20xx
+} /* rv3032Decode() */
+
+static void rv3032Encode(unsigned char *pFrame)
+{
+	pFrame[0] = 1; // start at the seconds register
+	pFrame[4] -= 1;
+	pFrame[6] &= 0x1f;
+} /* rv3032Encode() */
+
+//
+// Read the current internal temperature
+// Value is celcius * 4 (the chip has 1/16C; the LSB holds the fraction
+// in its upper 4 bits)
+//
+static int rv3032GetTemp(rtc_dev *pRTC)
+{
+unsigned char ucTemp[2];
+
+	if (i2cReadReg(pRTC->pBus, pRTC->iAddr, 0xe, ucTemp, 2) != 0)
+		return 0;
+	return ((signed char)ucTemp[1] * 4) + (ucTemp[0] >> 6);
+} /* rv3032GetTemp() */
+
+//
+// Set Alarm for:
+// ALARM_SECOND = Once every second (periodic time update)
+// ALARM_MINUTE = Once every minute (periodic time update)
+// ALARM_TIME = When a specific hour:minute match
+// ALARM_DATE = When a specific day of the month and time match
+// ALARM_DAY isn't supported by the chip
+// Control 1 + 2 come from the shadow copy and are only written when
+// they change
+// returns 0 for success, -1 for error
+//
+static int rv3032SetAlarm(rtc_dev *pRTC, unsigned char type, struct tm *pTime)
+{
+unsigned char ucCtrl[2], ucAlarm[3];
+int rc = -1;
+
+	i2cBusLock(pRTC->pBus);
+	if (rtcShadowRead(pRTC, 0x10, ucCtrl, 2) != 0) // control 1 + 2
+		goto done;
+	switch (type)
+	{
+		case ALARM_SECOND:
+		case ALARM_MINUTE:
+			if (type == ALARM_SECOND)
+				ucCtrl[0] &= ~RV_USEL;
+			else
+				ucCtrl[0] |= RV_USEL;
+			ucCtrl[1] |= RV_UIE;
+			break;
+		case ALARM_TIME:
+		case ALARM_DATE:
+			ucAlarm[0] = BIN2BCD(pTime->tm_min);
+			ucAlarm[1] = BIN2BCD(pTime->tm_hour);
+			ucAlarm[2] = (type == ALARM_DATE) ? BIN2BCD(pTime->tm_mday) : 0x80;
+			if (rtcShadowWrite(pRTC, 8, ucAlarm, 3) != 0) // minute, hour, date alarms
+				goto done;
+			ucCtrl[1] |= RV_AIE;
+			break;
+		default:
+			goto done;
+	}
+	rc = rtcShadowWrite(pRTC, 0x10, ucCtrl, 2);
+done:
+	i2cBusUnlock(pRTC->pBus);
+	return rc;
+} /* rv3032SetAlarm() */
+
+//
+// Reset the alarm, timer and time update flags (the interrupts stay enabled)
+// Every bit of the status register is a flag which can only be cleared,
+// so the other flags are written as 1 to leave them alone
+// returns 0 for success, -1 for error
+//
+static int rv3032ClearAlarms(rtc_dev *pRTC)
+{
+unsigned char ucTemp[2];
+int rc;
+
+	ucTemp[0] = 0xd; // status
+	ucTemp[1] = (unsigned char)~(RV_AF | RV_TF | RV_UF);
+	i2cBusLock(pRTC->pBus);
+	rc = i2cWriteData(pRTC->pBus, pRTC->iAddr, ucTemp, 2);
+	if (rc == 0)
+		pRTC->ucShadow[0xd] &= ucTemp[1];
+	else
+		pRTC->bShadowValid = 0;
+	i2cBusUnlock(pRTC->pBus);
+	return rc;
+} /* rv3032ClearAlarms() */
+
+//
+// Turn off the alarm (RTC_ALARM1) and time update (RTC_ALARM2) interrupts
+// returns 0 for success, -1 for error
+//
+static int rv3032DisableAlarms(rtc_dev *pRTC, int iAlarms)
+{
+unsigned char ucClear;
+
+	ucClear = ((iAlarms & RTC_ALARM1) ? RV_AIE : 0) | ((iAlarms & RTC_ALARM2) ? RV_UIE : 0);
+	return rtcShadowUpdate(pRTC, 0x11, ucClear, 0); // control 2
+} /* rv3032DisableAlarms() */
+
+//
+// Turn the status flags into a mask of RTC_ALARM1 / RTC_ALARM2
+// UF is set every second (or minute) whether or not UIE is, and AF stays
+// set after the alarm is disabled, so only the enabled ones count
+//
+static int rv3032Fired(unsigned char ucStatus, unsigned char ucCtrl2)
+{
+int iFired = 0;
+
+	if ((ucStatus & RV_AF) && (ucCtrl2 & RV_AIE))
+		iFired |= RTC_ALARM1;
+	if ((ucStatus & RV_UF) && (ucCtrl2 & RV_UIE))
+		iFired |= RTC_ALARM2;
+	return iFired;
+} /* rv3032Fired() */
+
+//
+// Read the status register and clear the flags which are set
+// returns a mask of the enabled RTC_ALARM1 (alarm) / RTC_ALARM2 (time update)
+// which fired or -1 for error
+//
+static int rv3032AckAlarms(rtc_dev *pRTC)
+{
+unsigned char ucTemp[2], ucFlags, ucCtrl;
+int iFired;
+
+	i2cBusLock(pRTC->pBus);
+	if (rtcShadowRead(pRTC, 0x11, &ucCtrl, 1) != 0 ||
+	    i2cReadReg(pRTC->pBus, pRTC->iAddr, 0xd, &ucTemp[1], 1) != 0)
+	{
+		i2cBusUnlock(pRTC->pBus);
+		return -1;
+	}
+	ucFlags = ucTemp[1] & (RV_AF | RV_UF);
+	iFired = rv3032Fired(ucFlags, ucCtrl);
+	if (iFired)
+	{
+		ucTemp[0] = 0xd;
+		ucTemp[1] = (unsigned char)~ucFlags;
+		if (i2cWriteData(pRTC->pBus, pRTC->iAddr, ucTemp, 2) != 0)
+			iFired = -1;
+	}
+	i2cBusUnlock(pRTC->pBus);
+	return iFired;
+} /* rv3032AckAlarms() */
+
+//
+// Registers 0-0x12 (100ths, time, alarm, timer, status, temperature,
+// control) in one read
+// alarm[1] is the periodic time update
+// returns 0 for success, -1 for error
+//
+static int rv3032Snapshot(rtc_dev *pRTC, rtc_snapshot *pSnap)
+{
+unsigned char ucRegs[0x13];
+rtc_alarm_info *pAlarm = &pSnap->alarm[0];
+
+	if (rtcDevReadReg(pRTC, 0, ucRegs, sizeof(ucRegs)) != 0)
+		return -1;
+	pSnap->iHundredths = BCD2BIN(ucRegs[0]);
+	rv3032Decode(&ucRegs[1]);
+	pSnap->llTime = rtcDecodeEpoch(&ucRegs[1]);
+	pSnap->iTemp = ((signed char)ucRegs[0xf] * 4) + (ucRegs[0xe] >> 6);
+	pSnap->ucControl = ucRegs[0x11]; // control 2 (interrupt enables)
+	pSnap->ucStatus = ucRegs[0xd];
+	pSnap->bOscStopped = (ucRegs[0xd] & 3) != 0; // VLF or PORF
+	pSnap->iFired = rv3032Fired(ucRegs[0xd], ucRegs[0x11]);
+	pAlarm->bEnabled = (ucRegs[0x11] & RV_AIE) != 0;
+	pAlarm->iSec = 0; // no seconds register
+	pAlarm->iMin = ALARM2BIN(ucRegs[8], 0x7f);
+	pAlarm->iHour = ALARM2BIN(ucRegs[9], 0x3f);
+	pAlarm->iDay = ALARM2BIN(ucRegs[10], 0x3f);
+	pAlarm = &pSnap->alarm[1];
+	pAlarm->bEnabled = (ucRegs[0x11] & RV_UIE) != 0;
+	pAlarm->iSec = (ucRegs[0x10] & RV_USEL) ? 0 : -1; // every minute or every second
+	pAlarm->iMin = pAlarm->iHour = pAlarm->iDay = -1;
+	return 0;
+} /* rv3032Snapshot() */
+
+const rtc_chip rtcChipRV3032 = {
+	RTC_RV3032,
+	1, // time registers start at 1 (after the 100ths)
+	{{0x08, 11}, {0xc0, 6}}, // alarm, timer, status, temperature, control 1-3; PMU, offset, CLKOUT
+	rv3032Init,
+	rv3032Decode,
+	rv3032Encode,
+	rv3032GetTemp,
+	rv3032SetAlarm,
+	rv3032ClearAlarms,
+	rv3032DisableAlarms,
+	rv3032AckAlarms,
+	rv3032Snapshot
+};
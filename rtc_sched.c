@@ -0,0 +1,313 @@
+//
+// DS3231 and xxx
+// Real Time Clock + EEPROM library
+// Software timer scheduler
+//
+// Keeps any number of one-shot and periodic timers in a min-heap and
+// programs the nearest deadline into Alarm 1, so the system can sleep
+// until the next event instead of waking every second to check.
+//
+// The PCF8563 and RV-3032 alarms have no seconds register and go off at
+// second 00 of the matching minute, so on those chips the deadlines are
+// rounded up to the next whole minute and rtcSchedRun() fires every
+// timer due within the current minute. Timers there fire up to 59
+// seconds late (or early, when they share a minute with an earlier one)
+// and a period under a minute fires at most once a minute.
+//
+// Typical use:
+//   pSched = rtcSchedCreate(pRTC);
+//   rtcSchedAdd(pSched, tWhen, 0, callback, pUser);
+//   while (1) {
+//      rtcAlarmWait(pRTC, -1);
+//      rtcSchedRun(pSched);
+//   }
+//
+// Written by Larry Bank
+// Copyright (c) 2018 BitBank Software, Inc.
+// bitbank@pobox.com
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "rtc.h"
+#include "rtc_priv.h"
+
+// A date match only repeats once a month; deadlines further away than
+// this get an intermediate wake-up so Alarm 1 can't fire a month early
+#define MAX_ALARM_SPAN (27*24*60*60)
+
+typedef struct rtc_timer {
+	time_t tWhen; // next deadline (RTC time, seconds since 1970)
+	int iPeriod; // seconds between repeats or 0 for one-shot
+	int iId;
+	rtc_timer_cb pfnCallback;
+	void *pUser;
+} rtc_timer;
+
+struct rtc_sched {
+	rtc_dev *pRTC;
+	rtc_timer *pTimers; // min-heap ordered by tWhen
+	int iCount, iSize;
+	int iNextId;
+	int iGrain; // alarm resolution in seconds (1 or 60)
+	time_t tArmed; // deadline currently in Alarm 1 (0 = none)
+	pthread_mutex_t mutex;
+};
+
+//
+// Current RTC time in seconds
+//
+static time_t rtcSchedTime(rtc_sched *pSched)
+{
+	return (time_t)rtcDevGetEpoch(pSched->pRTC);
+} /* rtcSchedTime() */
+
+//
+// Last second of the alarm period which contains tNow; everything due
+// by then is handled now, since the alarm can't wake us for it later
+//
+static time_t rtcSchedDue(rtc_sched *pSched, time_t tNow)
+{
+	return ((tNow / pSched->iGrain) * pSched->iGrain) + pSched->iGrain - 1;
+} /* rtcSchedDue() */
+
+//
+// Restore the heap order after an entry moved
+//
+static void rtcSchedSiftUp(rtc_sched *pSched, int i)
+{
+rtc_timer t = pSched->pTimers[i];
+int iParent;
+
+	while (i > 0)
+	{
+		iParent = (i - 1) / 2;
+		if (pSched->pTimers[iParent].tWhen <= t.tWhen)
+			break;
+		pSched->pTimers[i] = pSched->pTimers[iParent];
+		i = iParent;
+	}
+	pSched->pTimers[i] = t;
+} /* rtcSchedSiftUp() */
+
+static void rtcSchedSiftDown(rtc_sched *pSched, int i)
+{
+rtc_timer t = pSched->pTimers[i];
+int iChild;
+
+	while ((iChild = (i * 2) + 1) < pSched->iCount)
+	{
+		if (iChild + 1 < pSched->iCount && pSched->pTimers[iChild+1].tWhen < pSched->pTimers[iChild].tWhen)
+			iChild++;
+		if (t.tWhen <= pSched->pTimers[iChild].tWhen)
+			break;
+		pSched->pTimers[i] = pSched->pTimers[iChild];
+		i = iChild;
+	}
+	pSched->pTimers[i] = t;
+} /* rtcSchedSiftDown() */
+
+//
+// Remove the entry at index i
+//
+static void rtcSchedRemove(rtc_sched *pSched, int i)
+{
+	pSched->iCount--;
+	if (i == pSched->iCount)
+		return;
+	pSched->pTimers[i] = pSched->pTimers[pSched->iCount];
+	rtcSchedSiftDown(pSched, i);
+	rtcSchedSiftUp(pSched, i);
+} /* rtcSchedRemove() */
+
+//
+// Program Alarm 1 for the nearest deadline, or turn its interrupt off
+// when there are no timers left so it can't wake the system for nothing
+// (called with the mutex held)
+//
+static void rtcSchedArm(rtc_sched *pSched, time_t tNow)
+{
+time_t tWhen;
+struct tm tm;
+
+	if (pSched->iCount == 0)
+	{
+		pSched->tArmed = 0;
+		rtcDevDisableAlarms(pSched->pRTC, RTC_ALARM1); // no write if it's already off
+		return;
+	}
+	tWhen = pSched->pTimers[0].tWhen;
+	if (tWhen <= tNow) // already due; a past match wouldn't fire for a month
+		tWhen = tNow + 1;
+	if (tWhen - tNow > MAX_ALARM_SPAN)
+		tWhen = tNow + MAX_ALARM_SPAN;
+	// a minute alarm goes off at its start; don't let that be early
+	tWhen = ((tWhen + pSched->iGrain - 1) / pSched->iGrain) * pSched->iGrain;
+	if (tWhen == pSched->tArmed) // already there
+		return;
+	gmtime_r(&tWhen, &tm);
+	// on failure, leave it unarmed so the next call tries again
+	pSched->tArmed = (rtcDevSetAlarm(pSched->pRTC, ALARM_DATE, &tm) == 0) ? tWhen : 0;
+} /* rtcSchedArm() */
+
+//
+// Create a scheduler which owns Alarm 1 of the given RTC
+// returns NULL for failure
+//
+rtc_sched *rtcSchedCreate(rtc_dev *pRTC)
+{
+rtc_sched *pSched;
+
+	pSched = (rtc_sched *)calloc(1, sizeof(rtc_sched));
+	if (pSched == NULL)
+		return NULL;
+	pSched->pRTC = pRTC;
+	pSched->iNextId = 1;
+	// only the DS3231 has a seconds alarm
+	pSched->iGrain = (rtcDevGetType(pRTC) == RTC_DS3231) ? 1 : 60;
+	pthread_mutex_init(&pSched->mutex, NULL);
+	return pSched;
+} /* rtcSchedCreate() */
+
+void rtcSchedFree(rtc_sched *pSched)
+{
+	if (pSched == NULL)
+		return;
+	pthread_mutex_destroy(&pSched->mutex);
+	free(pSched->pTimers);
+	free(pSched);
+} /* rtcSchedFree() */
+
+//
+// Add a timer which fires at tWhen (RTC time in seconds since 1970)
+// and then every iPeriod seconds (0 = once)
+// On the PCF8563 and RV-3032 it fires within the minute after tWhen
+// returns the timer id or -1 for error
+//
+int rtcSchedAdd(rtc_sched *pSched, time_t tWhen, int iPeriod, rtc_timer_cb pfnCallback, void *pUser)
+{
+rtc_timer *pNew;
+time_t tNow;
+int iId;
+
+	tNow = rtcSchedTime(pSched);
+	if (tNow == (time_t)-1 || iPeriod < 0)
+		return -1;
+	pthread_mutex_lock(&pSched->mutex);
+	if (pSched->iCount == pSched->iSize) // grow the heap
+	{
+		pNew = (rtc_timer *)realloc(pSched->pTimers, (pSched->iSize + 16) * sizeof(rtc_timer));
+		if (pNew == NULL)
+		{
+			pthread_mutex_unlock(&pSched->mutex);
+			return -1;
+		}
+		pSched->pTimers = pNew;
+		pSched->iSize += 16;
+	}
+	iId = pSched->iNextId++;
+	pNew = &pSched->pTimers[pSched->iCount++];
+	pNew->tWhen = tWhen;
+	pNew->iPeriod = iPeriod;
+	pNew->iId = iId;
+	pNew->pfnCallback = pfnCallback;
+	pNew->pUser = pUser;
+	rtcSchedSiftUp(pSched, pSched->iCount - 1);
+	rtcSchedArm(pSched, tNow);
+	pthread_mutex_unlock(&pSched->mutex);
+	return iId;
+} /* rtcSchedAdd() */
+
+//
+// Remove a timer
+// returns 0 for success, -1 if it doesn't exist
+//
+int rtcSchedCancel(rtc_sched *pSched, int iId)
+{
+int i, rc = -1;
+time_t tNow;
+
+	pthread_mutex_lock(&pSched->mutex);
+	for (i=0; i<pSched->iCount; i++)
+	{
+		if (pSched->pTimers[i].iId == iId)
+		{
+			rtcSchedRemove(pSched, i);
+			rc = 0;
+			break;
+		}
+	}
+	// no need to touch the alarm unless the nearest deadline changed
+	if (rc == 0 && i == 0 && (tNow = rtcSchedTime(pSched)) != (time_t)-1)
+		rtcSchedArm(pSched, tNow);
+	pthread_mutex_unlock(&pSched->mutex);
+	return rc;
+} /* rtcSchedCancel() */
+
+//
+// Get the next deadline or 0 if there are no timers
+//
+time_t rtcSchedNext(rtc_sched *pSched)
+{
+time_t t;
+
+	pthread_mutex_lock(&pSched->mutex);
+	t = (pSched->iCount) ? pSched->pTimers[0].tWhen : 0;
+	pthread_mutex_unlock(&pSched->mutex);
+	return t;
+} /* rtcSchedNext() */
+
+//
+// Fire every timer which is due and program the next deadline
+// Call this after Alarm 1 fires. Callbacks run without the scheduler
+// locked, so they may add or cancel timers.
+// returns the number of timers fired or -1 for error
+//
+int rtcSchedRun(rtc_sched *pSched)
+{
+rtc_timer t;
+time_t tNow, tDue;
+int iFired = 0;
+
+	tNow = rtcSchedTime(pSched);
+	if (tNow == (time_t)-1)
+		return -1;
+	pthread_mutex_lock(&pSched->mutex);
+	pSched->tArmed = 0; // whatever was armed has passed
+	tDue = rtcSchedDue(pSched, tNow);
+	while (pSched->iCount && pSched->pTimers[0].tWhen <= tDue)
+	{
+		t = pSched->pTimers[0];
+		if (t.iPeriod) // re-arm it, skipping any periods we slept through
+		{
+			pSched->pTimers[0].tWhen += (((tDue - t.tWhen) / t.iPeriod) + 1) * t.iPeriod;
+			rtcSchedSiftDown(pSched, 0);
+		}
+		else
+		{
+			rtcSchedRemove(pSched, 0);
+		}
+		pthread_mutex_unlock(&pSched->mutex);
+		if (t.pfnCallback)
+			(*t.pfnCallback)(t.iId, t.pUser);
+		iFired++;
+		pthread_mutex_lock(&pSched->mutex);
+		if (pSched->iCount && pSched->pTimers[0].tWhen > tDue)
+		{
+			// the callbacks may have taken a while; check again
+			pthread_mutex_unlock(&pSched->mutex);
+			tNow = rtcSchedTime(pSched);
+			pthread_mutex_lock(&pSched->mutex);
+			if (tNow == (time_t)-1)
+				break;
+			tDue = rtcSchedDue(pSched, tNow);
+		}
+	}
+	if (tNow != (time_t)-1)
+		rtcSchedArm(pSched, tNow);
+	pthread_mutex_unlock(&pSched->mutex);
+	return iFired;
+} /* rtcSchedRun() */
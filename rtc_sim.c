@@ -0,0 +1,633 @@
+//
+// DS3231 and xxx
+// Real Time Clock + EEPROM library
+// Simulated devices
+//
+// Register-level models of the DS3231, PCF8563, RV-3032 and AT24Cxx
+// behind a bus backend (rtcBusRegister), so the rest of the library can
+// be tested and benchmarked on a machine without any I2C hardware.
+//
+// The RTCs keep time from the simulator's clock, latch the time
+// registers at the start of each message, restart the seconds countdown
+// when the seconds register is written and raise their alarm flags,
+// including the PCF8563 countdown timer (TF) and the RV-3032 periodic
+// time update (UF) behind the repeating alarms of those chips.
+// The EEPROM wraps page writes within the page buffer and NAKs its
+// address for the write cycle time after each STOP which ends a write.
+//
+// Typical use:
+//   pSim = rtcSimCreate(9, 400000, 1);
+//   rtcSimAddRTC(pSim, RTC_DS3231, 0x68, time(NULL));
+//   rtcSimAddEEPROM(pSim, 0x57, 4096, 32, 5000);
+//   pRTC = rtcOpen(9, 0x68);
+//
+// Written by Larry Bank
+// Copyright (c) 2018 BitBank Software, Inc.
+// bitbank@pobox.com
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "rtc.h"
+#include "rtc_priv.h"
+
+#define NS_PER_SEC 1000000000LL
+#define SIM_MAX_DEVS 8
+#define SIM_EEPROM RTC_TYPE_COUNT // device type of the EEPROM model
+#define SIM_MAX_CATCHUP (400*24*60*60) // alarm history kept across a jump (s)
+
+typedef struct sim_dev {
+	int iType; // RTC_xxx or SIM_EEPROM
+	int iAddr; // slave address
+	int iBlocks; // number of slave addresses it answers (from iAddr)
+	int iPtr; // register pointer / memory address
+	// RTC
+	int iRegCount; // the register pointer wraps here
+	unsigned char ucRegs[256];
+	int64_t llTime; // RTC time at llSetNs (seconds since 1970)
+	int64_t llSetNs; // start of that second in simulator time
+	int64_t llChecked; // alarms have been evaluated up to this second
+	int iWdayBias; // weekday register relative to the real weekday
+	uint32_t ulUnixBias; // RV-3032 UNIX counter relative to llTime
+	int64_t llTimerNs; // PCF8563 countdown timer was (re)started at this simulator time
+	int64_t llTimerChecked; // and has been evaluated up to this one
+	// EEPROM
+	unsigned char *pMem;
+	int iSize, iPageSize;
+	int64_t llWriteNs; // write cycle time
+	int64_t llBusyUntil; // NAKs until this simulator time
+	int bWritten; // data was latched in the current transaction
+} sim_dev;
+
+struct rtc_sim {
+	int iChannel;
+	int iBusHz;
+	int bVirtual; // time only moves with the bus and rtcSimAdvance()
+	int64_t llNow; // virtual time, or offset added to CLOCK_MONOTONIC (ns)
+	int64_t llBusNs; // modelled time spent on the bus (ns)
+	int iCount;
+	sim_dev devs[SIM_MAX_DEVS];
+	pthread_mutex_t mutex;
+};
+
+//
+// Current simulator time in ns
+//
+static int64_t rtcSimTime(rtc_sim *pSim)
+{
+struct timespec ts;
+
+	if (pSim->bVirtual)
+		return pSim->llNow;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * NS_PER_SEC) + ts.tv_nsec + pSim->llNow;
+} /* rtcSimTime() */
+
+//
+// Register map of each RTC model
+// iTime = first time register, iCount = number of time registers
+// iFlags/ucFlagMask = status flags which can only be written to 0
+// iRO/iROCount = read-only registers
+//
+static void rtcSimLayout(int iType, int *iTime, int *iCount, int *iFlags, unsigned char *ucFlagMask, int *iRO, int *iROCount)
+{
+	switch (iType)
+	{
+		case RTC_DS3231:
+			*iTime = 0; *iCount = 7;
+			*iFlags = 0x0f; *ucFlagMask = 0x83; // OSF, A2F, A1F
+			*iRO = 0x11; *iROCount = 2; // temperature
+			break;
+		case RTC_PCF8563:
+			*iTime = 2; *iCount = 7;
+			*iFlags = 0x01; *ucFlagMask = 0x0c; // AF, TF
+			*iRO = 0; *iROCount = 0;
+			break;
+		default: // RTC_RV3032
+			*iTime = 0; *iCount = 8; // starts with the 100ths of a second
+			*iFlags = 0x0d; *ucFlagMask = 0xff;
+			*iRO = 0x0e; *iROCount = 2; // temperature
+			break;
+	}
+} /* rtcSimLayout() */
+
+//
+// Current RTC time in seconds
+//
+static int64_t rtcSimSeconds(sim_dev *pDev, int64_t llNs)
+{
+int64_t llDelta = llNs - pDev->llSetNs;
+
+	if (llDelta < 0) // rtcSimAdvance only moves forward, but be safe
+		return pDev->llTime;
+	return pDev->llTime + (llDelta / NS_PER_SEC);
+} /* rtcSimSeconds() */
+
+//
+// Check whether the time in a register frame (DS3231 order) matches
+// the minute, hour and day/date alarm registers
+// Bit 7 of each alarm register masks that field; bit 6 of the
+// day/date register selects the day of the week
+//
+static int rtcSimMatch(unsigned char *ucAlarm, unsigned char *ucFrame, int iWday, int bDay)
+{
+	if (!(ucAlarm[0] & 0x80) && (ucAlarm[0] & 0x7f) != ucFrame[2])
+		return 0;
+	if (!(ucAlarm[1] & 0x80) && (ucAlarm[1] & 0x3f) != ucFrame[3])
+		return 0;
+	if (!(ucAlarm[2] & 0x80))
+	{
+		if (bDay && (ucAlarm[2] & 0x40)) // weekday
+			return ((ucAlarm[2] & 0x0f) == iWday);
+		if ((ucAlarm[2] & 0x3f) != ucFrame[5])
+			return 0;
+	}
+	return 1;
+} /* rtcSimMatch() */
+
+//
+// Length of one PCF8563 countdown (ns) or 0 if the timer is off
+// Timer control 0x0E: TE = bit 7, source clock in bits 1-0
+// (4096Hz, 64Hz, 1Hz, 1/60Hz); 0x0F = number of source clocks
+//
+static int64_t rtcSimTimerNs(sim_dev *pDev)
+{
+static const int64_t llSource[4] = {NS_PER_SEC / 4096, NS_PER_SEC / 64, NS_PER_SEC, 60 * NS_PER_SEC};
+
+	if (!(pDev->ucRegs[0x0e] & 0x80))
+		return 0;
+	return llSource[pDev->ucRegs[0x0e] & 3] * pDev->ucRegs[0x0f];
+} /* rtcSimTimerNs() */
+
+//
+// Raise the alarm flags for every second which passed since the last
+// check. Alarms only trigger on whole minutes or on a chosen second,
+// so it's enough to look at the start of each minute. The PCF8563
+// timer runs on the simulator clock and sets TF each time it reaches 0
+//
+static void rtcSimTick(sim_dev *pDev, int64_t llNow)
+{
+int64_t llSec, llMin, s;
+unsigned char ucFrame[8], ucAlarm[4];
+int iWday;
+
+	if (pDev->iType == RTC_PCF8563 && (s = rtcSimTimerNs(pDev)) != 0 && llNow > pDev->llTimerChecked)
+	{
+		if ((llNow - pDev->llTimerNs) / s > (pDev->llTimerChecked - pDev->llTimerNs) / s)
+			pDev->ucRegs[1] |= 4; // TF
+		pDev->llTimerChecked = llNow;
+	}
+	llSec = rtcSimSeconds(pDev, llNow);
+	if (llSec <= pDev->llChecked)
+		return;
+	if (llSec - pDev->llChecked > SIM_MAX_CATCHUP)
+		pDev->llChecked = llSec - SIM_MAX_CATCHUP;
+	// RV-3032 periodic time update: every second, or minute with USEL
+	if (pDev->iType == RTC_RV3032 && (!(pDev->ucRegs[0x10] & 0x10) || (llSec / 60) > (pDev->llChecked / 60)))
+		pDev->ucRegs[0x0d] |= 0x20; // UF
+	for (llMin = ((pDev->llChecked + 1) / 60) * 60; llMin <= llSec; llMin += 60)
+	{
+		rtcEncodeEpoch(llMin, ucFrame);
+		iWday = (((ucFrame[4] - 1) + pDev->iWdayBias) % 7); // 0-6
+		if (pDev->iType == RTC_DS3231)
+		{
+			// Alarm 1 (A1M1 set = any second)
+			if (pDev->ucRegs[7] & 0x80)
+				s = (pDev->llChecked + 1 > llMin) ? pDev->llChecked + 1 : llMin;
+			else
+				s = llMin + BCD2BIN(pDev->ucRegs[7] & 0x7f);
+			if (s > pDev->llChecked && s <= llSec && rtcSimMatch(&pDev->ucRegs[8], ucFrame, iWday + 1, 1))
+				pDev->ucRegs[0x0f] |= 1;
+			// Alarm 2 (always on second 00)
+			if (llMin > pDev->llChecked && rtcSimMatch(&pDev->ucRegs[0x0b], ucFrame, iWday + 1, 1))
+				pDev->ucRegs[0x0f] |= 2;
+		}
+		else if (llMin > pDev->llChecked)
+		{
+			if (pDev->iType == RTC_PCF8563) // minute, hour, day, weekday
+			{
+				memcpy(ucAlarm, &pDev->ucRegs[9], 3);
+				if ((ucAlarm[0] & ucAlarm[1] & ucAlarm[2] & pDev->ucRegs[12] & 0x80) == 0 && // something enabled
+					rtcSimMatch(ucAlarm, ucFrame, 0, 0) &&
+					((pDev->ucRegs[12] & 0x80) || (pDev->ucRegs[12] & 7) == iWday))
+					pDev->ucRegs[1] |= 8; // AF
+			}
+			else // RV3032: minute, hour, date
+			{
+				memcpy(ucAlarm, &pDev->ucRegs[8], 3);
+				if ((ucAlarm[0] & ucAlarm[1] & ucAlarm[2] & 0x80) == 0 &&
+					rtcSimMatch(ucAlarm, ucFrame, 0, 0))
+					pDev->ucRegs[0x0d] |= 8; // AF
+			}
+		}
+	}
+	pDev->llChecked = llSec;
+} /* rtcSimTick() */
+
+//
+// Latch the current time into the time registers
+//
+static void rtcSimLoad(sim_dev *pDev, int64_t llNow)
+{
+unsigned char ucFrame[8];
+int64_t llSec, llSub;
+uint32_t ul;
+int iWday;
+
+	rtcSimTick(pDev, llNow);
+	llSec = rtcSimSeconds(pDev, llNow);
+	rtcEncodeEpoch(llSec, ucFrame);
+	iWday = ((ucFrame[4] - 1) + pDev->iWdayBias) % 7; // 0-6
+	switch (pDev->iType)
+	{
+		case RTC_DS3231:
+			memcpy(pDev->ucRegs, &ucFrame[1], 7);
+			pDev->ucRegs[3] = iWday + 1;
+			break;
+		case RTC_PCF8563:
+			pDev->ucRegs[2] = ucFrame[1] | (pDev->ucRegs[2] & 0x80); // keep VL
+			pDev->ucRegs[3] = ucFrame[2];
+			pDev->ucRegs[4] = ucFrame[3];
+			pDev->ucRegs[5] = ucFrame[5];
+			pDev->ucRegs[6] = iWday;
+			pDev->ucRegs[7] = ucFrame[6];
+			pDev->ucRegs[8] = ucFrame[7];
+			break;
+		case RTC_RV3032:
+			llSub = (llNow - pDev->llSetNs) % NS_PER_SEC;
+			if (llSub < 0) llSub = 0;
+			pDev->ucRegs[0] = BIN2BCD((int)(llSub / 10000000));
+			memcpy(&pDev->ucRegs[1], &ucFrame[1], 7);
+			pDev->ucRegs[4] = iWday;
+			pDev->ucRegs[6] &= 0x1f; // no century bit
+			ul = (uint32_t)llSec + pDev->ulUnixBias;
+			pDev->ucRegs[0x1b] = (unsigned char)ul;
+			pDev->ucRegs[0x1c] = (unsigned char)(ul >> 8);
+			pDev->ucRegs[0x1d] = (unsigned char)(ul >> 16);
+			pDev->ucRegs[0x1e] = (unsigned char)(ul >> 24);
+			break;
+	}
+} /* rtcSimLoad() */
+
+//
+// Take the time registers written by the host as the new time
+// bSeconds = the seconds register was written, which restarts the
+// countdown to the next second
+//
+static void rtcSimStore(sim_dev *pDev, int64_t llNow, int bSeconds)
+{
+unsigned char ucFrame[8];
+int64_t llSub;
+int iWday;
+
+	switch (pDev->iType)
+	{
+		case RTC_DS3231:
+			memcpy(ucFrame, pDev->ucRegs, 7);
+			iWday = (pDev->ucRegs[3] - 1) & 7;
+			break;
+		case RTC_PCF8563:
+			ucFrame[0] = pDev->ucRegs[2] & 0x7f;
+			ucFrame[1] = pDev->ucRegs[3] & 0x7f;
+			ucFrame[2] = pDev->ucRegs[4] & 0x3f;
+			ucFrame[4] = pDev->ucRegs[5] & 0x3f;
+			ucFrame[5] = pDev->ucRegs[7] & 0x9f;
+			ucFrame[6] = pDev->ucRegs[8];
+			iWday = pDev->ucRegs[6] & 7;
+			break;
+		default: // RTC_RV3032 (2000-2099)
+			memcpy(ucFrame, &pDev->ucRegs[1], 7);
+			ucFrame[5] = (ucFrame[5] & 0x1f) | 0x80;
+			iWday = pDev->ucRegs[4] & 7;
+			break;
+	}
+	llSub = (llNow - pDev->llSetNs) % NS_PER_SEC;
+	if (bSeconds || llSub < 0)
+		llSub = 0;
+	pDev->llTime = rtcDecodeEpoch(ucFrame);
+	if (pDev->llTime < 0) // garbage in the registers
+		pDev->llTime = 0;
+	pDev->llSetNs = llNow - llSub;
+	pDev->llChecked = pDev->llTime; // the new second itself doesn't trigger
+	rtcEncodeEpoch(pDev->llTime, ucFrame);
+	pDev->iWdayBias = (iWday - (ucFrame[4] - 1) + 14) % 7;
+} /* rtcSimStore() */
+
+//
+// Handle one message addressed to an RTC
+//
+static void rtcSimRTC(sim_dev *pDev, struct i2c_msg *pMsg, int64_t llNow)
+{
+int i, iReg, iTime, iCount, iFlags, iRO, iROCount, bTime = 0, bSeconds = 0, bUnix = 0, bTimer = 0;
+unsigned char ucFlagMask, uc;
+uint32_t ul;
+
+	rtcSimLoad(pDev, llNow);
+	rtcSimLayout(pDev->iType, &iTime, &iCount, &iFlags, &ucFlagMask, &iRO, &iROCount);
+	if (pMsg->flags & I2C_M_RD)
+	{
+		for (i=0; i<pMsg->len; i++)
+		{
+			pMsg->buf[i] = pDev->ucRegs[pDev->iPtr];
+			pDev->iPtr = (pDev->iPtr + 1) % pDev->iRegCount;
+		}
+		return;
+	}
+	if (pMsg->len == 0)
+		return;
+	pDev->iPtr = pMsg->buf[0] % pDev->iRegCount;
+	for (i=1; i<pMsg->len; i++)
+	{
+		iReg = pDev->iPtr;
+		uc = pMsg->buf[i];
+		if (iReg == iFlags) // flags can be cleared but not set
+			pDev->ucRegs[iReg] = (pDev->ucRegs[iReg] & uc & ucFlagMask) | (uc & ~ucFlagMask);
+		else if (iReg < iRO || iReg >= iRO + iROCount)
+			pDev->ucRegs[iReg] = uc;
+		if (iReg >= iTime && iReg < iTime + iCount)
+		{
+			bTime = 1;
+			if (iReg == ((pDev->iType == RTC_PCF8563) ? 2 : (pDev->iType == RTC_RV3032) ? 1 : 0))
+				bSeconds = 1;
+		}
+		if (pDev->iType == RTC_RV3032 && iReg >= 0x1b && iReg <= 0x1e)
+			bUnix = 1;
+		if (pDev->iType == RTC_PCF8563 && iReg >= 0x0e)
+			bTimer = 1;
+		pDev->iPtr = (pDev->iPtr + 1) % pDev->iRegCount;
+	}
+	if (bTime)
+		rtcSimStore(pDev, llNow, bSeconds);
+	if (bTimer) // writing the timer registers reloads the countdown
+		pDev->llTimerNs = pDev->llTimerChecked = llNow;
+	if (bUnix) // the UNIX counter runs independently of the calendar
+	{
+		ul = pDev->ucRegs[0x1b] | (pDev->ucRegs[0x1c] << 8) | (pDev->ucRegs[0x1d] << 16) | ((uint32_t)pDev->ucRegs[0x1e] << 24);
+		pDev->ulUnixBias = ul - (uint32_t)rtcSimSeconds(pDev, llNow);
+	}
+} /* rtcSimRTC() */
+
+//
+// Handle one message addressed to an EEPROM
+// A write sets the address and latches data into the page buffer; the
+// address wraps at the end of the page (writes) or of the memory
+// (reads). Parts of up to 2K take 1 address byte and the block number
+// from the slave address, larger ones take 2 address bytes
+//
+static void rtcSimEEPROM(sim_dev *pDev, struct i2c_msg *pMsg, int iBlock)
+{
+int i, iMask, iHeader;
+
+	if (pMsg->flags & I2C_M_RD)
+	{
+		for (i=0; i<pMsg->len; i++)
+		{
+			pMsg->buf[i] = pDev->pMem[pDev->iPtr];
+			pDev->iPtr = (pDev->iPtr + 1) % pDev->iSize;
+		}
+		return;
+	}
+	iHeader = (pDev->iSize > 2048) ? 2 : 1;
+	if (pMsg->len < iHeader) // ACK poll (or a partial address)
+		return;
+	if (iHeader == 1)
+		pDev->iPtr = ((iBlock << 8) | pMsg->buf[0]) % pDev->iSize;
+	else
+		pDev->iPtr = ((pMsg->buf[0] << 8) | pMsg->buf[1]) % pDev->iSize;
+	iMask = pDev->iPageSize - 1;
+	for (i=iHeader; i<pMsg->len; i++)
+	{
+		pDev->pMem[pDev->iPtr] = pMsg->buf[i];
+		pDev->iPtr = (pDev->iPtr & ~iMask) | ((pDev->iPtr + 1) & iMask);
+		pDev->bWritten = 1;
+	}
+} /* rtcSimEEPROM() */
+
+//
+// Bus backend: run one transaction against the simulated devices
+// Each message costs a (repeated) start, the address byte and 9 bits per
+// data byte; the transaction ends with a STOP
+//
+static int rtcSimTransfer(void *pCtx, struct i2c_msg *pMsgs, int iCount)
+{
+rtc_sim *pSim = (rtc_sim *)pCtx;
+sim_dev *pDev;
+int64_t llNow, llBits = 1; // STOP
+int i, j, rc = 0;
+
+	pthread_mutex_lock(&pSim->mutex);
+	llNow = rtcSimTime(pSim);
+	for (i=0; i<iCount && rc == 0; i++)
+	{
+		llBits += 10; // start + address + ACK
+		pDev = NULL;
+		for (j=0; j<pSim->iCount; j++)
+		{
+			if (pMsgs[i].addr >= pSim->devs[j].iAddr && pMsgs[i].addr < pSim->devs[j].iAddr + pSim->devs[j].iBlocks)
+				pDev = &pSim->devs[j];
+		}
+		if (pDev == NULL || (pDev->iType == SIM_EEPROM && llNow < pDev->llBusyUntil))
+		{
+			rc = -1; // NAK
+			errno = ENXIO;
+			break;
+		}
+		llBits += 9 * pMsgs[i].len;
+		if (pDev->iType == SIM_EEPROM)
+			rtcSimEEPROM(pDev, &pMsgs[i], pMsgs[i].addr - pDev->iAddr);
+		else
+			rtcSimRTC(pDev, &pMsgs[i], llNow);
+	}
+	for (j=0; j<pSim->iCount; j++) // the STOP starts the write cycles
+	{
+		pDev = &pSim->devs[j];
+		if (pDev->bWritten)
+		{
+			pDev->llBusyUntil = llNow + pDev->llWriteNs;
+			pDev->bWritten = 0;
+		}
+	}
+	llBits = (llBits * NS_PER_SEC) / pSim->iBusHz;
+	pSim->llBusNs += llBits;
+	if (pSim->bVirtual)
+		pSim->llNow += llBits;
+	pthread_mutex_unlock(&pSim->mutex);
+	return rc;
+} /* rtcSimTransfer() */
+
+//
+// Create an empty simulated bus and serve I2C channel iChannel with it
+// iBusHz = modelled clock speed (0 = 100kHz)
+// bVirtual = 1 for a deterministic clock which only moves with the
+// bus and rtcSimAdvance(), 0 to follow CLOCK_MONOTONIC
+// returns NULL for failure
+//
+rtc_sim *rtcSimCreate(int iChannel, int iBusHz, int bVirtual)
+{
+rtc_sim *pSim;
+
+	pSim = (rtc_sim *)calloc(1, sizeof(rtc_sim));
+	if (pSim == NULL)
+		return NULL;
+	pSim->iChannel = iChannel;
+	pSim->iBusHz = (iBusHz > 0) ? iBusHz : 100000;
+	pSim->bVirtual = bVirtual;
+	pthread_mutex_init(&pSim->mutex, NULL);
+	if (rtcBusRegister(iChannel, rtcSimTransfer, pSim) != 0)
+	{
+		pthread_mutex_destroy(&pSim->mutex);
+		free(pSim);
+		return NULL;
+	}
+	return pSim;
+} /* rtcSimCreate() */
+
+//
+// Remove the simulated bus
+// (close the devices opened on it first)
+//
+void rtcSimFree(rtc_sim *pSim)
+{
+int i;
+
+	if (pSim == NULL)
+		return;
+	rtcBusUnregister(pSim->iChannel);
+	for (i=0; i<pSim->iCount; i++)
+		free(pSim->devs[i].pMem);
+	pthread_mutex_destroy(&pSim->mutex);
+	free(pSim);
+} /* rtcSimFree() */
+
+//
+// Find a free device slot
+// (called with the mutex held)
+//
+static sim_dev *rtcSimNewDev(rtc_sim *pSim, int iAddr, int iBlocks)
+{
+sim_dev *pDev;
+int i;
+
+	if (pSim->iCount == SIM_MAX_DEVS)
+		return NULL;
+	for (i=0; i<pSim->iCount; i++)
+	{
+		if (iAddr < pSim->devs[i].iAddr + pSim->devs[i].iBlocks && pSim->devs[i].iAddr < iAddr + iBlocks)
+			return NULL; // address conflict
+	}
+	pDev = &pSim->devs[pSim->iCount++];
+	memset(pDev, 0, sizeof(sim_dev));
+	pDev->iAddr = iAddr;
+	pDev->iBlocks = iBlocks;
+	return pDev;
+} /* rtcSimNewDev() */
+
+//
+// Add an RTC (RTC_DS3231, RTC_PCF8563 or RTC_RV3032) running at
+// llTime seconds since 1970
+// returns 0 for success, -1 for error
+//
+int rtcSimAddRTC(rtc_sim *pSim, int iType, int iAddr, int64_t llTime)
+{
+sim_dev *pDev;
+
+	if (iType <= RTC_UNKNOWN || iType >= RTC_TYPE_COUNT || llTime < 0)
+		return -1;
+	pthread_mutex_lock(&pSim->mutex);
+	pDev = rtcSimNewDev(pSim, iAddr, 1);
+	if (pDev == NULL)
+	{
+		pthread_mutex_unlock(&pSim->mutex);
+		return -1;
+	}
+	pDev->iType = iType;
+	pDev->llTime = pDev->llChecked = llTime;
+	pDev->llSetNs = rtcSimTime(pSim);
+	switch (iType)
+	{
+		case RTC_DS3231:
+			pDev->iRegCount = 0x13;
+			pDev->ucRegs[0x0e] = 0x1c; // power-on state of control/status
+			pDev->ucRegs[0x0f] = 0x88;
+			pDev->ucRegs[0x11] = 25; // 25.00C
+			break;
+		case RTC_PCF8563:
+			pDev->iRegCount = 0x10;
+			pDev->ucRegs[9] = pDev->ucRegs[10] = pDev->ucRegs[11] = pDev->ucRegs[12] = 0x80; // alarms off
+			break;
+		default: // RTC_RV3032
+			pDev->iRegCount = 0x100;
+			pDev->ucRegs[8] = pDev->ucRegs[9] = pDev->ucRegs[10] = 0x80;
+			pDev->ucRegs[0x0f] = 25;
+			break;
+	}
+	pthread_mutex_unlock(&pSim->mutex);
+	return 0;
+} /* rtcSimAddRTC() */
+
+//
+// Add an EEPROM of iSize bytes (erased to 0xFF) with an iPageSize byte
+// page buffer and a write cycle of iWriteUs (0 = 5ms)
+// Up to 2K it's a 1 address byte part which answers a slave address
+// per 256 bytes from iAddr (like a 24C16)
+// returns 0 for success, -1 for error
+//
+int rtcSimAddEEPROM(rtc_sim *pSim, int iAddr, int iSize, int iPageSize, int iWriteUs)
+{
+sim_dev *pDev;
+unsigned char *pMem;
+int iBlocks;
+
+	if (iSize <= 0 || iPageSize <= 0 || (iPageSize & (iPageSize - 1)) || iSize % iPageSize)
+		return -1;
+	iBlocks = (iSize > 256 && iSize <= 2048) ? (iSize + 255) / 256 : 1;
+	pMem = (unsigned char *)malloc(iSize);
+	if (pMem == NULL)
+		return -1;
+	memset(pMem, 0xff, iSize);
+	pthread_mutex_lock(&pSim->mutex);
+	pDev = rtcSimNewDev(pSim, iAddr, iBlocks);
+	if (pDev == NULL)
+	{
+		pthread_mutex_unlock(&pSim->mutex);
+		free(pMem);
+		return -1;
+	}
+	pDev->iType = SIM_EEPROM;
+	pDev->pMem = pMem;
+	pDev->iSize = iSize;
+	pDev->iPageSize = iPageSize;
+	pDev->llWriteNs = ((iWriteUs > 0) ? iWriteUs : 5000) * 1000LL;
+	pthread_mutex_unlock(&pSim->mutex);
+	return 0;
+} /* rtcSimAddEEPROM() */
+
+//
+// Move the simulator's clock forward
+//
+void rtcSimAdvance(rtc_sim *pSim, int64_t llNs)
+{
+	if (llNs <= 0)
+		return;
+	pthread_mutex_lock(&pSim->mutex);
+	pSim->llNow += llNs;
+	pthread_mutex_unlock(&pSim->mutex);
+} /* rtcSimAdvance() */
+
+//
+// Total modelled time the bus was busy in ns
+// (what the transfers would have taken on real wires)
+//
+int64_t rtcSimBusTime(rtc_sim *pSim)
+{
+int64_t llNs;
+
+	pthread_mutex_lock(&pSim->mutex);
+	llNs = pSim->llBusNs;
+	pthread_mutex_unlock(&pSim->mutex);
+	return llNs;
+} /* rtcSimBusTime() */